@@ -0,0 +1,232 @@
+#ifndef CALIBRATE_H
+#define CALIBRATE_H
+
+#include "decoder.h"
+
+// Playback is timed over CALIBRATION_FRAMES once the frame threads are filled up, a seek until the
+// first CALIBRATION_SEEK_FRAMES frames came out of a fresh decoder (about where the average seek
+// target sits after its keyframe, without the skipped frames).
+#define CALIBRATION_WARMUP_FRAMES 8
+#define CALIBRATION_FRAMES        24
+#define CALIBRATION_SEEK_FRAMES   4
+#define CALIBRATION_MAX_ENTRIES   16
+#define CALIBRATION_MAX_CANDIDATES 4
+
+struct ThreadCalibration
+{
+	AVCodecID    codecId;
+	int          width;
+	int          height;
+	ThreadPolicy policy[DecodeMode_Count];
+	bool         calibrated[DecodeMode_Count];
+};
+
+// NOTE: Every codec and resolution is only calibrated once per run. Only the calibration thread of
+// the current video file writes to this, and it is waited for (freeVideoFile()) before the next
+// file is set up, so there is no lock.
+struct ThreadCalibrations
+{
+	ThreadCalibration entries[CALIBRATION_MAX_ENTRIES];
+	int               count = 0;
+};
+
+struct CalibrationJob
+{
+	VideoFile          *vfile;
+	ThreadCalibrations *calibrations;
+	bool                calibrate[DecodeMode_Count];
+};
+
+internal ThreadCalibration *findThreadCalibration(ThreadCalibrations *calibrations, VideoFile *vfile)
+{
+	int count = (calibrations->count < CALIBRATION_MAX_ENTRIES) ?
+		calibrations->count : CALIBRATION_MAX_ENTRIES;
+	for(int i = 0; i < count; ++i)
+	{
+		ThreadCalibration *entry = &calibrations->entries[i];
+		if(entry->codecId == vfile->codec->id && entry->width == vfile->width &&
+		   entry->height == vfile->height)
+		{
+			return entry;
+		}
+	}
+	return NULL;
+}
+
+internal int threadPolicyCandidates(DecodeMode mode, ThreadPolicy *candidates)
+{
+	int cores = SDL_GetCPUCount();
+	int half = (cores / 2 > 1) ? cores / 2 : 2;
+	int n = 0;
+	candidates[n++] = threadPolicy(1, 0);
+	if(cores < 2) return n;
+
+	if(mode == DecodeMode_Seek)
+	{
+		candidates[n++] = threadPolicy(cores, FF_THREAD_SLICE);
+		candidates[n++] = threadPolicy(half, FF_THREAD_FRAME | FF_THREAD_SLICE);
+	}
+	else
+	{
+		candidates[n++] = threadPolicy(cores, FF_THREAD_FRAME | FF_THREAD_SLICE);
+		candidates[n++] = threadPolicy(cores, FF_THREAD_FRAME);
+		candidates[n++] = threadPolicy(cores, FF_THREAD_SLICE);
+	}
+	return n;
+}
+
+// Milliseconds per frame for playback, milliseconds until the first frames came out for a seek.
+// Negative if the calibration was aborted or nothing could be decoded.
+internal float timeThreadPolicy(VideoFile *vfile, DecodeMode mode, ThreadPolicy policy)
+{
+	Decoder dec;
+	if(!openDecoderWithThreads(&dec, vfile, policy)) return -1.0f;
+
+	bool playback = mode == DecodeMode_Playback;
+	int warmup = playback ? CALIBRATION_WARMUP_FRAMES : 0;
+	int frames = playback ? CALIBRATION_FRAMES : CALIBRATION_SEEK_FRAMES;
+	SDL_atomic_t *abort = &vfile->threading.calibrationAbort;
+
+	for(int i = 0; i < warmup && !SDL_AtomicGet(abort); ++i)
+	{
+		decodeNextFrame(&dec.pipe, dec.frame);
+	}
+
+	uint64 start = SDL_GetPerformanceCounter();
+	int decoded = 0;
+	while(decoded < frames && !SDL_AtomicGet(abort) && decodeNextFrame(&dec.pipe, dec.frame))
+	{
+		++decoded;
+	}
+	uint64 elapsed = SDL_GetPerformanceCounter() - start;
+	closeDecoder(&dec);
+
+	if(SDL_AtomicGet(abort) || decoded == 0) return -1.0f;
+	float ms = (float)((double)elapsed * 1000.0 / (double)SDL_GetPerformanceFrequency());
+	return playback ? ms / decoded : ms;
+}
+
+internal int threadCalibrationThread(void *data)
+{
+	CalibrationJob *job = (CalibrationJob *)data;
+	VideoFile *vfile = job->vfile;
+	DecodeThreading *threading = &vfile->threading;
+
+	SDL_SetThreadPriority(SDL_THREAD_PRIORITY_LOW);
+
+	ThreadCalibration result = {};
+	result.codecId = vfile->codec->id;
+	result.width = vfile->width;
+	result.height = vfile->height;
+
+	for(int mode = 0; mode < DecodeMode_Count; ++mode)
+	{
+		if(!job->calibrate[mode]) continue;
+
+		ThreadPolicy candidates[CALIBRATION_MAX_CANDIDATES];
+		int ncandidates = threadPolicyCandidates((DecodeMode)mode, candidates);
+		float best = -1.0f;
+		for(int i = 0; i < ncandidates; ++i)
+		{
+			float ms = timeThreadPolicy(vfile, (DecodeMode)mode, candidates[i]);
+			if(SDL_AtomicGet(&threading->calibrationAbort))
+			{
+				free(job);
+				return 0;
+			}
+			printf("Calibrating %s threading: %s, %d threads: %.2f ms\n",
+			       decodeModeName((DecodeMode)mode), threadTypeName(candidates[i].threadType),
+			       candidates[i].threadCount, ms); // DEBUG
+			if(ms >= 0.0f && (best < 0.0f || ms < best))
+			{
+				best = ms;
+				result.policy[mode] = candidates[i];
+			}
+		}
+		// Nothing could be decoded, stay with the defaults
+		if(best < 0.0f) result.policy[mode] = threading->policy[mode];
+		result.calibrated[mode] = best >= 0.0f;
+	}
+
+	for(int mode = 0; mode < DecodeMode_Count; ++mode)
+	{
+		if(job->calibrate[mode])
+		{
+			threading->policy[mode] = result.policy[mode];
+			printThreadPolicy("Calibrated", (DecodeMode)mode, result.policy[mode]); // DEBUG
+		}
+	}
+
+	ThreadCalibrations *calibrations = job->calibrations;
+	ThreadCalibration *entry = findThreadCalibration(calibrations, vfile);
+	if(!entry)
+	{
+		entry = &calibrations->entries[calibrations->count % CALIBRATION_MAX_ENTRIES];
+		*entry = ThreadCalibration();
+		calibrations->count++;
+	}
+	entry->codecId = result.codecId;
+	entry->width = result.width;
+	entry->height = result.height;
+	for(int mode = 0; mode < DecodeMode_Count; ++mode)
+	{
+		if(!result.calibrated[mode]) continue;
+		entry->policy[mode] = result.policy[mode];
+		entry->calibrated[mode] = true;
+	}
+
+	// NOTE: Publishes the policies, the clip's decoder picks them up with its next seek
+	SDL_AtomicSet(&threading->calibrated, 1);
+	free(job);
+	return 0;
+}
+
+// Decides the threading policy of both decode modes for a freshly loaded video file, call it
+// before the clip is created. Command line overrides and earlier calibrations are applied right
+// away, everything else is calibrated on a worker thread while the defaults are in use.
+void setupDecodeThreading(VideoFile *vfile, ThreadingOverride *override,
+                          ThreadCalibrations *calibrations)
+{
+	DecodeThreading *threading = &vfile->threading;
+	ThreadCalibration *known = findThreadCalibration(calibrations, vfile);
+
+	CalibrationJob *job = (CalibrationJob *)malloc(sizeof(CalibrationJob));
+	job->vfile = vfile;
+	job->calibrations = calibrations;
+	bool calibrate = false;
+	for(int mode = 0; mode < DecodeMode_Count; ++mode)
+	{
+		job->calibrate[mode] = false;
+		if(override->set[mode])
+		{
+			threading->policy[mode] = override->policy[mode];
+		}
+		else if(known && known->calibrated[mode])
+		{
+			threading->policy[mode] = known->policy[mode];
+		}
+		else
+		{
+			job->calibrate[mode] = true;
+			calibrate = true;
+			continue;
+		}
+		if(!sameThreadPolicy(threading->policy[mode], threading->opened[mode]))
+		{
+			reopenDecodeContext(vfile, (DecodeMode)mode);
+		}
+	}
+
+	if(calibrate)
+	{
+		SDL_AtomicSet(&threading->calibrationAbort, 0);
+		threading->calibrationThread = SDL_CreateThread(threadCalibrationThread, "MouseCalibrate", job);
+	}
+	else
+	{
+		SDL_AtomicSet(&threading->calibrated, 1);
+		free(job);
+	}
+}
+
+#endif
@@ -0,0 +1,121 @@
+#ifndef DECODER_H
+#define DECODER_H
+
+// NOTE: An independent demuxer and decoder on a video file. Worker threads that decode on their
+// own (scrub cache, prefetching) each open one of these so they never touch the clip's decoder.
+struct Decoder
+{
+	AVFormatContext *formatCtx = NULL;
+	AVCodecContext  *codecCtx  = NULL;
+	AVFrame         *frame     = NULL;
+	int              streamIndex = -1;
+	DecodePipeline   pipe;
+};
+
+// Called for every frame decodeGop() produces, with the frame's display index.
+typedef void (*DecodedFrameCallback)(void *userdata, int index, AVFrame *frame);
+
+// Workers run next to each other, so by default each decoder gets a single thread.
+bool openDecoderWithThreads(Decoder *dec, VideoFile *vfile, ThreadPolicy policy)
+{
+	*dec = Decoder();
+	if(avformat_open_input(&dec->formatCtx, vfile->formatCtx->filename, NULL, NULL) != 0)
+	{
+		printf("Decoder could not open file: %s\n", vfile->formatCtx->filename);
+		return false;
+	}
+	avformat_find_stream_info(dec->formatCtx, NULL);
+
+	dec->streamIndex = vfile->streamIndex;
+	AVCodecContext *codecCtxOrig = dec->formatCtx->streams[dec->streamIndex]->codec;
+	AVCodec *codec = avcodec_find_decoder(codecCtxOrig->codec_id);
+	dec->codecCtx = avcodec_alloc_context3(codec);
+	avcodec_copy_context(dec->codecCtx, codecCtxOrig);
+	dec->codecCtx->refcounted_frames = 1;
+	applyThreadPolicy(dec->codecCtx, policy);
+	if(avcodec_open2(dec->codecCtx, codec, NULL) < 0)
+	{
+		printf("Decoder could not open codec for: %s\n", vfile->formatCtx->filename);
+		avcodec_free_context(&dec->codecCtx);
+		avformat_close_input(&dec->formatCtx);
+		return false;
+	}
+	dec->frame = av_frame_alloc();
+	createDecodePipeline(&dec->pipe, dec->formatCtx, dec->codecCtx, dec->streamIndex);
+	return true;
+}
+
+inline bool openDecoder(Decoder *dec, VideoFile *vfile)
+{
+	return openDecoderWithThreads(dec, vfile, ThreadPolicy());
+}
+
+void closeDecoder(Decoder *dec)
+{
+	freeDecodePipeline(&dec->pipe);
+	av_frame_free(&dec->frame);
+	if(dec->codecCtx)
+	{
+		avcodec_close(dec->codecCtx);
+		avcodec_free_context(&dec->codecCtx);
+	}
+	if(dec->formatCtx) avformat_close_input(&dec->formatCtx);
+	*dec = Decoder();
+}
+
+// Reading past this many packets is cheaper than a seek, see decodeIntraFrame()
+#define INTRA_SKIP_PACKETS 16
+
+// Decodes a single frame of an intra-only video (every packet is a keyframe, vfile->intraOnly)
+// into dec->frame. When the frame's packet is a few packets ahead of the decoder the packets in
+// between are read past, otherwise the demuxer seeks straight to it. The decoder has to be single
+// threaded so it holds no frames back.
+bool decodeIntraFrame(Decoder *dec, VideoFile *vfile, int wanted)
+{
+	DecodePipeline *pipe = &dec->pipe;
+	int packet = vfile->index.displayToDecode[wanted];
+	for(int attempt = 0; attempt < 2; ++attempt)
+	{
+		int ahead = packet - pipe->nextPacket;
+		if(pipe->nextPacket < 0 || ahead < 0 || ahead > INTRA_SKIP_PACKETS || !skipPackets(pipe, ahead))
+		{
+			if(!seekDecodePipeline(pipe, packet, vfile->index.dts[packet])) return false;
+		}
+		if(!decodeNextFrame(pipe, dec->frame))
+		{
+			pipe->nextPacket = -1;
+			return false;
+		}
+		if(av_frame_get_best_effort_timestamp(dec->frame) == framePts(vfile, wanted)) return true;
+		// Lost track of the packets, seek the second time
+		pipe->nextPacket = -1;
+	}
+	return false;
+}
+
+// Decodes every frame of a GOP (an index into the keyframe list), handing each one to the
+// callback. The index must be complete. Returns false if the GOP could not be decoded or the work
+// was cancelled. Decoding stops once the GOP's last frame (in display order) came out.
+bool decodeGop(Decoder *dec, VideoFile *vfile, int gop, CancelToken cancel,
+               DecodedFrameCallback callback, void *userdata)
+{
+	int first, end, start;
+	gopPacketRange(vfile, gop, &first, &end);
+	gopFrameRange(vfile, gop, &start, &end);
+
+	if(!seekDecodePipeline(&dec->pipe, first, vfile->index.dts[first])) return false;
+
+	int index = -1;
+	while(index < end - 1 && decodeNextFrame(&dec->pipe, dec->frame))
+	{
+		if(cancelled(cancel)) return false;
+		int frame = frameIndexFromPts(vfile, av_frame_get_best_effort_timestamp(dec->frame));
+		// Leading frames of an open GOP are missing their references in the previous GOP
+		if(frame < start) continue;
+		index = frame;
+		callback(userdata, index, dec->frame);
+	}
+	return true;
+}
+
+#endif
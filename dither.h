@@ -0,0 +1,282 @@
+#ifndef DITHER_H
+#define DITHER_H
+
+// NOTE: High bit depth to 8-bit conversion. 10 and 12-bit planar 4:2:0 and 4:2:2 (little endian,
+// the samples in the low bits of each uint16) are turned into the clip's 8-bit YUV420P planes
+// without sws_scale: every sample gets an ordered dither value (8x8 Bayer matrix scaled to the
+// bits that are dropped) added and is shifted down, 4:2:2 chroma averages each pair of rows.
+//
+// The row kernels come in a scalar reference version and SSE2/AVX2 versions that have to give the
+// exact same bytes. selectDitherKernels() picks the widest one the CPU has and checks it against
+// the scalar kernels once before it is used (checkDitherKernels()).
+
+#if defined(__GNUC__)
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define TARGET_AVX2
+#endif
+
+// Samples in a row for one dither value each, the dither pattern repeats after this many
+#define DITHER_PERIOD 8
+
+typedef void (*DitherRowFn)(const uint16 *src, uint8 *dst, int width, int shift,
+                            const uint16 *dither);
+typedef void (*DitherAvgRowFn)(const uint16 *a, const uint16 *b, uint8 *dst, int width,
+                               int shift, const uint16 *dither);
+
+struct DitherKernels
+{
+	DitherRowFn    row    = NULL;
+	DitherAvgRowFn avgRow = NULL;  // Averages two rows first (4:2:2 chroma)
+	const char    *name   = "none";
+};
+
+// Bits per sample of the high bit depth formats that have kernels, 0 for everything else.
+inline int ditherBits(int format, bool *chroma422)
+{
+	*chroma422 = format == AV_PIX_FMT_YUV422P10LE || format == AV_PIX_FMT_YUV422P12LE;
+	if(format == AV_PIX_FMT_YUV420P10LE || format == AV_PIX_FMT_YUV422P10LE) return 10;
+	if(format == AV_PIX_FMT_YUV420P12LE || format == AV_PIX_FMT_YUV422P12LE) return 12;
+	return 0;
+}
+
+internal void ditherRowScalar(const uint16 *src, uint8 *dst, int width, int shift,
+                              const uint16 *dither)
+{
+	for(int x = 0; x < width; ++x)
+	{
+		int value = (src[x] + dither[x % DITHER_PERIOD]) >> shift;
+		dst[x] = (value > 255) ? 255 : (uint8)value;
+	}
+}
+
+internal void ditherAvgRowScalar(const uint16 *a, const uint16 *b, uint8 *dst, int width,
+                                 int shift, const uint16 *dither)
+{
+	for(int x = 0; x < width; ++x)
+	{
+		int average = (a[x] + b[x] + 1) >> 1;
+		int value = (average + dither[x % DITHER_PERIOD]) >> shift;
+		dst[x] = (value > 255) ? 255 : (uint8)value;
+	}
+}
+
+// NOTE: The SIMD kernels add with unsigned saturation, which only differs from the scalar add for
+// samples with garbage above the format's bits, and those end up at 255 either way. The loops step
+// by a multiple of DITHER_PERIOD, so the scalar kernel picks up the rest with the same pattern.
+internal void ditherRowSSE2(const uint16 *src, uint8 *dst, int width, int shift,
+                            const uint16 *dither)
+{
+	__m128i pattern = _mm_loadu_si128((const __m128i *)dither);
+	__m128i count = _mm_cvtsi32_si128(shift);
+	int x = 0;
+	for(; x + 16 <= width; x += 16)
+	{
+		__m128i lo = _mm_loadu_si128((const __m128i *)(src + x));
+		__m128i hi = _mm_loadu_si128((const __m128i *)(src + x + 8));
+		lo = _mm_srl_epi16(_mm_adds_epu16(lo, pattern), count);
+		hi = _mm_srl_epi16(_mm_adds_epu16(hi, pattern), count);
+		_mm_storeu_si128((__m128i *)(dst + x), _mm_packus_epi16(lo, hi));
+	}
+	ditherRowScalar(src + x, dst + x, width - x, shift, dither);
+}
+
+internal void ditherAvgRowSSE2(const uint16 *a, const uint16 *b, uint8 *dst, int width,
+                               int shift, const uint16 *dither)
+{
+	__m128i pattern = _mm_loadu_si128((const __m128i *)dither);
+	__m128i count = _mm_cvtsi32_si128(shift);
+	int x = 0;
+	for(; x + 16 <= width; x += 16)
+	{
+		__m128i lo = _mm_avg_epu16(_mm_loadu_si128((const __m128i *)(a + x)),
+		                           _mm_loadu_si128((const __m128i *)(b + x)));
+		__m128i hi = _mm_avg_epu16(_mm_loadu_si128((const __m128i *)(a + x + 8)),
+		                           _mm_loadu_si128((const __m128i *)(b + x + 8)));
+		lo = _mm_srl_epi16(_mm_adds_epu16(lo, pattern), count);
+		hi = _mm_srl_epi16(_mm_adds_epu16(hi, pattern), count);
+		_mm_storeu_si128((__m128i *)(dst + x), _mm_packus_epi16(lo, hi));
+	}
+	ditherAvgRowScalar(a + x, b + x, dst + x, width - x, shift, dither);
+}
+
+// _mm256_packus_epi16() packs each 128-bit lane on its own, the permute puts the quadwords back in
+// order.
+TARGET_AVX2 internal void ditherRowAVX2(const uint16 *src, uint8 *dst, int width, int shift,
+                                        const uint16 *dither)
+{
+	__m256i pattern = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)dither));
+	__m128i count = _mm_cvtsi32_si128(shift);
+	int x = 0;
+	for(; x + 32 <= width; x += 32)
+	{
+		__m256i lo = _mm256_loadu_si256((const __m256i *)(src + x));
+		__m256i hi = _mm256_loadu_si256((const __m256i *)(src + x + 16));
+		lo = _mm256_srl_epi16(_mm256_adds_epu16(lo, pattern), count);
+		hi = _mm256_srl_epi16(_mm256_adds_epu16(hi, pattern), count);
+		__m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(lo, hi), 0xD8);
+		_mm256_storeu_si256((__m256i *)(dst + x), packed);
+	}
+	ditherRowSSE2(src + x, dst + x, width - x, shift, dither);
+}
+
+TARGET_AVX2 internal void ditherAvgRowAVX2(const uint16 *a, const uint16 *b, uint8 *dst, int width,
+                                           int shift, const uint16 *dither)
+{
+	__m256i pattern = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)dither));
+	__m128i count = _mm_cvtsi32_si128(shift);
+	int x = 0;
+	for(; x + 32 <= width; x += 32)
+	{
+		__m256i lo = _mm256_avg_epu16(_mm256_loadu_si256((const __m256i *)(a + x)),
+		                              _mm256_loadu_si256((const __m256i *)(b + x)));
+		__m256i hi = _mm256_avg_epu16(_mm256_loadu_si256((const __m256i *)(a + x + 16)),
+		                              _mm256_loadu_si256((const __m256i *)(b + x + 16)));
+		lo = _mm256_srl_epi16(_mm256_adds_epu16(lo, pattern), count);
+		hi = _mm256_srl_epi16(_mm256_adds_epu16(hi, pattern), count);
+		__m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(lo, hi), 0xD8);
+		_mm256_storeu_si256((__m256i *)(dst + x), packed);
+	}
+	ditherAvgRowSSE2(a + x, b + x, dst + x, width - x, shift, dither);
+}
+
+internal DitherKernels ditherKernels(DitherRowFn row, DitherAvgRowFn avgRow, const char *name)
+{
+	DitherKernels kernels;
+	kernels.row = row;
+	kernels.avgRow = avgRow;
+	kernels.name = name;
+	return kernels;
+}
+
+// The dither values of row y for dropping shift bits, one per column of the pattern.
+internal void ditherPattern(int y, int shift, uint16 *dither)
+{
+	local const uint8 bayer[DITHER_PERIOD][DITHER_PERIOD] =
+	{
+		{  0, 32,  8, 40,  2, 34, 10, 42 },
+		{ 48, 16, 56, 24, 50, 18, 58, 26 },
+		{ 12, 44,  4, 36, 14, 46,  6, 38 },
+		{ 60, 28, 52, 20, 62, 30, 54, 22 },
+		{  3, 35, 11, 43,  1, 33,  9, 41 },
+		{ 51, 19, 59, 27, 49, 17, 57, 25 },
+		{ 15, 47,  7, 39, 13, 45,  5, 37 },
+		{ 63, 31, 55, 23, 61, 29, 53, 21 },
+	};
+	for(int x = 0; x < DITHER_PERIOD; ++x)
+	{
+		dither[x] = (uint16)((bayer[y % DITHER_PERIOD][x] << shift) >> 6);
+	}
+}
+
+// Runs the kernels and the scalar reference over the same rows (every dither pattern row, widths
+// that leave a tail, both bit depths) and compares the bytes. Returns false on any difference.
+bool checkDitherKernels(DitherKernels *kernels)
+{
+	const int width = 93;
+	uint16 a[width];
+	uint16 b[width];
+	uint8 expected[width];
+	uint8 result[width];
+
+	uint32 seed = 12345;
+	for(int bits = 10; bits <= 12; bits += 2)
+	{
+		for(int y = 0; y < DITHER_PERIOD; ++y)
+		{
+			uint16 dither[DITHER_PERIOD];
+			ditherPattern(y, bits - 8, dither);
+			for(int x = 0; x < width; ++x)
+			{
+				seed = seed * 1664525 + 1013904223;
+				a[x] = (uint16)((seed >> 8) & ((1 << bits) - 1));
+				b[x] = (uint16)((seed >> 20) & ((1 << bits) - 1));
+			}
+			// The largest samples make sure the clamp at 255 agrees too
+			a[0] = b[0] = (uint16)((1 << bits) - 1);
+
+			for(int w = width - 2; w <= width; ++w)
+			{
+				ditherRowScalar(a, expected, w, bits - 8, dither);
+				kernels->row(a, result, w, bits - 8, dither);
+				if(memcmp(expected, result, w) != 0) return false;
+
+				ditherAvgRowScalar(a, b, expected, w, bits - 8, dither);
+				kernels->avgRow(a, b, result, w, bits - 8, dither);
+				if(memcmp(expected, result, w) != 0) return false;
+			}
+		}
+	}
+	return true;
+}
+
+// Picks the widest kernels the CPU runs, falling back to the scalar ones if they don't match them.
+DitherKernels selectDitherKernels()
+{
+	DitherKernels kernels = ditherKernels(ditherRowScalar, ditherAvgRowScalar, "scalar");
+	if(SDL_HasAVX2()) kernels = ditherKernels(ditherRowAVX2, ditherAvgRowAVX2, "AVX2");
+	else if(SDL_HasSSE2()) kernels = ditherKernels(ditherRowSSE2, ditherAvgRowSSE2, "SSE2");
+
+	bool matches = checkDitherKernels(&kernels);
+	assert(matches);
+	if(!matches)
+	{
+		printf("Dither kernels (%s) don't match the scalar ones, using those.\n", kernels.name);
+		kernels = ditherKernels(ditherRowScalar, ditherAvgRowScalar, "scalar");
+	}
+	return kernels;
+}
+
+// True if ditherFrameTo() can convert the frame (a kernel format at the video's size).
+inline bool ditherFrame(AVFrame *frame, int width, int height)
+{
+	bool chroma422;
+	return ditherBits(frame->format, &chroma422) && frame->width == width &&
+		frame->height == height && !(width & 1) && !(height & 1);
+}
+
+// Converts a high bit depth frame into YUV420P planes of its size (uvPitch = width / 2).
+void ditherFrameTo(DitherKernels *kernels, AVFrame *frame, uint8 *yPlane, uint8 *uPlane,
+                   uint8 *vPlane)
+{
+	bool chroma422;
+	int shift = ditherBits(frame->format, &chroma422) - 8;
+	int width = frame->width;
+	int height = frame->height;
+	uint16 dither[DITHER_PERIOD][DITHER_PERIOD];
+	for(int y = 0; y < DITHER_PERIOD; ++y)
+	{
+		ditherPattern(y, shift, dither[y]);
+	}
+
+	for(int y = 0; y < height; ++y)
+	{
+		const uint16 *src = (const uint16 *)(frame->data[0] + (int64)y * frame->linesize[0]);
+		kernels->row(src, yPlane + (int64)y * width, width, shift, dither[y % DITHER_PERIOD]);
+	}
+
+	uint8 *chroma[2] = { uPlane, vPlane };
+	for(int plane = 0; plane < 2; ++plane)
+	{
+		uint8 *data = frame->data[plane + 1];
+		int linesize = frame->linesize[plane + 1];
+		for(int y = 0; y < height / 2; ++y)
+		{
+			uint8 *dst = chroma[plane] + (int64)y * (width / 2);
+			const uint16 *pattern = dither[y % DITHER_PERIOD];
+			if(chroma422)
+			{
+				const uint16 *a = (const uint16 *)(data + (int64)(2 * y) * linesize);
+				const uint16 *b = (const uint16 *)(data + (int64)(2 * y + 1) * linesize);
+				kernels->avgRow(a, b, dst, width / 2, shift, pattern);
+			}
+			else
+			{
+				const uint16 *src = (const uint16 *)(data + (int64)y * linesize);
+				kernels->row(src, dst, width / 2, shift, pattern);
+			}
+		}
+	}
+}
+
+#endif
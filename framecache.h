@@ -0,0 +1,209 @@
+#ifndef FRAMECACHE_H
+#define FRAMECACHE_H
+
+// Default bounds for the decoded frame cache. Whichever bound is reached first limits the cache,
+// a bound of 0 means that bound is not used.
+#define FRAMECACHE_DEFAULT_FRAMES    120
+#define FRAMECACHE_DEFAULT_MEGABYTES 512
+
+// A single converted YUV420P frame, keyed by its display index in the video file.
+struct CachedFrame
+{
+	int    index  = -1; // -1 when the slot is empty
+	uint8 *yPlane = NULL;
+	uint8 *uPlane = NULL;
+	uint8 *vPlane = NULL;
+};
+
+// NOTE: The cache holds frames _around the playhead_. When it is full the frame that is furthest
+// away from the playhead is evicted, so stepping back and forth inside the last N frames never
+// has to go back to the decoder.
+// Prefetch threads insert frames concurrently, so a slot returned by frameCacheLookup() may only be
+// used while the cache is locked (lockFrameCache()). Inserting locks the cache by itself.
+struct FrameCache
+{
+	CachedFrame *slots;
+	SDL_mutex   *lock      = NULL;
+	uint32       nslots    = 0;
+	uint32       count     = 0;
+	int          width     = 0;
+	int          height    = 0;
+	int          yPlaneSz  = 0;
+	int          uvPlaneSz = 0;
+	uint64       hits      = 0;
+	uint64       misses    = 0;
+};
+
+void createFrameCache(FrameCache *cache, int width, int height, int maxFrames, int maxMegabytes)
+{
+	cache->width = width;
+	cache->height = height;
+	cache->yPlaneSz = width * height;
+	cache->uvPlaneSz = width * height / 4;
+
+	uint64 frameSz = (uint64)cache->yPlaneSz + (2 * (uint64)cache->uvPlaneSz);
+	uint64 nslots = maxFrames > 0 ? maxFrames : 0;
+	if(maxMegabytes > 0 && frameSz > 0)
+	{
+		uint64 byMegabytes = ((uint64)maxMegabytes * 1024 * 1024) / frameSz;
+		if(nslots == 0 || byMegabytes < nslots) nslots = byMegabytes;
+	}
+	if(nslots == 0) nslots = 1;
+
+	cache->nslots = (uint32)nslots;
+	cache->count = 0;
+	cache->hits = 0;
+	cache->misses = 0;
+
+	// Planes are only allocated when a slot is first used so a large cache costs nothing until
+	// it is actually filled.
+	cache->slots = (CachedFrame *)malloc(cache->nslots * sizeof(CachedFrame));
+	for(uint32 i = 0; i < cache->nslots; ++i)
+	{
+		cache->slots[i] = CachedFrame();
+	}
+	cache->lock = SDL_CreateMutex();
+}
+
+inline void lockFrameCache(FrameCache *cache)
+{
+	SDL_LockMutex(cache->lock);
+}
+
+inline void unlockFrameCache(FrameCache *cache)
+{
+	SDL_UnlockMutex(cache->lock);
+}
+
+void clearFrameCache(FrameCache *cache)
+{
+	lockFrameCache(cache);
+	for(uint32 i = 0; i < cache->nslots; ++i)
+	{
+		cache->slots[i].index = -1;
+	}
+	cache->count = 0;
+	unlockFrameCache(cache);
+}
+
+void freeFrameCache(FrameCache *cache)
+{
+	for(uint32 i = 0; i < cache->nslots; ++i)
+	{
+		free(cache->slots[i].yPlane);
+		free(cache->slots[i].uPlane);
+		free(cache->slots[i].vPlane);
+	}
+	free(cache->slots);
+	if(cache->lock) SDL_DestroyMutex(cache->lock);
+	cache->slots = NULL;
+	cache->lock = NULL;
+	cache->nslots = 0;
+	cache->count = 0;
+}
+
+// NOTE: Only use the returned slot while holding the cache lock.
+CachedFrame *frameCacheLookup(FrameCache *cache, int index)
+{
+	lockFrameCache(cache);
+	CachedFrame *result = NULL;
+	for(uint32 i = 0; i < cache->nslots; ++i)
+	{
+		if(cache->slots[i].index == index)
+		{
+			result = &cache->slots[i];
+			break;
+		}
+	}
+	if(result) cache->hits++;
+	else cache->misses++;
+	unlockFrameCache(cache);
+	return result;
+}
+
+// Same as frameCacheLookup() but does not count towards the hit/miss counters.
+bool frameCacheContains(FrameCache *cache, int index)
+{
+	lockFrameCache(cache);
+	bool result = false;
+	for(uint32 i = 0; i < cache->nslots; ++i)
+	{
+		if(cache->slots[i].index == index)
+		{
+			result = true;
+			break;
+		}
+	}
+	unlockFrameCache(cache);
+	return result;
+}
+
+// Same as frameCacheInsert() for planes with their own line sizes (a decoder's AVFrame), the rows
+// are copied straight into the slot.
+void frameCacheInsertStrided(FrameCache *cache, int index, int playhead,
+                             const uint8 * const *planes, const int *linesize)
+{
+	lockFrameCache(cache);
+	CachedFrame *empty = NULL;
+	CachedFrame *evict = NULL;
+	int farthest = -1;
+	for(uint32 i = 0; i < cache->nslots; ++i)
+	{
+		CachedFrame *s = &cache->slots[i];
+		if(s->index == index)
+		{
+			// Already cached, the decoded picture is the same.
+			unlockFrameCache(cache);
+			return;
+		}
+		if(s->index == -1)
+		{
+			if(!empty) empty = s;
+		}
+		else if(abs(s->index - playhead) > farthest)
+		{
+			farthest = abs(s->index - playhead);
+			evict = s;
+		}
+	}
+	CachedFrame *slot = empty ? empty : evict;
+
+	if(!slot->yPlane)
+	{
+		slot->yPlane = (uint8 *)malloc(cache->yPlaneSz);
+		slot->uPlane = (uint8 *)malloc(cache->uvPlaneSz);
+		slot->vPlane = (uint8 *)malloc(cache->uvPlaneSz);
+	}
+	if(slot->index == -1) cache->count++;
+
+	slot->index = index;
+	int uvWidth = cache->width / 2;
+	int uvHeight = cache->height / 2;
+	av_image_copy_plane(slot->yPlane, cache->width, planes[0], linesize[0], cache->width, cache->height);
+	av_image_copy_plane(slot->uPlane, uvWidth, planes[1], linesize[1], uvWidth, uvHeight);
+	av_image_copy_plane(slot->vPlane, uvWidth, planes[2], linesize[2], uvWidth, uvHeight);
+	unlockFrameCache(cache);
+}
+
+void frameCacheInsert(FrameCache *cache, int index, int playhead,
+                      uint8 *yPlane, uint8 *uPlane, uint8 *vPlane)
+{
+	const uint8 *planes[3] = { yPlane, uPlane, vPlane };
+	int linesize[3] = { cache->width, cache->width / 2, cache->width / 2 };
+	frameCacheInsertStrided(cache, index, playhead, planes, linesize);
+}
+
+void printFrameCacheInfo(FrameCache cache)
+{
+	uint64 lookups = cache.hits + cache.misses;
+	float hitRate = lookups ? ((float)cache.hits / (float)lookups) * 100.0f : 0.0f;
+	uint64 frameSz = (uint64)cache.yPlaneSz + (2 * (uint64)cache.uvPlaneSz);
+	printf("< FRAME CACHE\n");
+	printf("Slots: %d/%d (%.2f MB max)\n", cache.count, cache.nslots,
+	       (float)(frameSz * cache.nslots) / (1024.0f * 1024.0f));
+	printf("Hits: %llu, Misses: %llu (%.2f%% hit rate)\n", cache.hits, cache.misses, hitRate);
+	printf("> FRAME CACHE\n");
+	printf("\n");
+}
+
+#endif
@@ -0,0 +1,241 @@
+#ifndef INDEXFILE_H
+#define INDEXFILE_H
+
+#include "mappedfile.h"
+
+// NOTE: The frame index (see probeForNumberOfFrames()) is saved next to the video file as
+// "<filename>.mouseidx" so opening the same file again does not have to read every packet.
+// The sidecar is only trusted when the video's size, modification time and a hash of its first
+// and last bytes still match. It is memory mapped and the index arrays point straight into the
+// mapping, so loading it costs (almost) nothing no matter how long the video is.
+//
+// Bump INDEXFILE_VERSION whenever the layout of the header or of any of the arrays changes.
+#define INDEXFILE_VERSION   3
+#define INDEXFILE_EXTENSION ".mouseidx"
+#define INDEXFILE_HASHBYTES (64 * 1024) // Bytes hashed at both the start and the end of the file
+
+struct IndexFileHeader
+{
+	char   magic[8];
+	uint32 version;
+	uint32 headerSize;
+	uint64 fileSize;
+	int64  fileMtime;
+	uint64 contentHash;
+	int32  streamIndex;
+	uint32 nframes;
+	uint32 nkeyframes;
+	int32  maxGopLength;
+	// Offsets of the FrameIndex arrays, in the order they are written
+	uint64 ptsOffset;
+	uint64 dtsOffset;
+	uint64 parentKeyframeOffset;
+	uint64 decodeToDisplayOffset;
+	uint64 posOffset;
+	uint64 sizeOffset;
+	uint64 displayPtsOffset;
+	uint64 displayToDecodeOffset;
+	uint64 keyframesOffset;
+};
+
+global const char INDEXFILE_MAGIC[8] = { 'M', 'O', 'U', 'S', 'E', 'I', 'D', 'X' };
+
+// FNV-1a over a block of bytes
+inline uint64 hashBytes(uint64 hash, const uint8 *bytes, size_t count)
+{
+	for(size_t i = 0; i < count; ++i)
+	{
+		hash ^= bytes[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+// Gets the size, modification time and partial content hash of a video file.
+bool getVideoFileSignature(const char *filename, uint64 *size, int64 *mtime, uint64 *hash)
+{
+#ifdef _WIN32
+	struct _stat64 st;
+	if(_stat64(filename, &st) != 0) return false;
+#else
+	struct stat st;
+	if(stat(filename, &st) != 0) return false;
+#endif
+	*size = (uint64)st.st_size;
+	*mtime = (int64)st.st_mtime;
+
+	FILE *file = fopen(filename, "rb");
+	if(!file) return false;
+
+	uint8 *buffer = (uint8 *)malloc(INDEXFILE_HASHBYTES);
+	uint64 h = hashBytes(14695981039346656037ULL, (uint8 *)size, sizeof(*size));
+
+	size_t read = fread(buffer, 1, INDEXFILE_HASHBYTES, file);
+	h = hashBytes(h, buffer, read);
+	if(*size > 2 * INDEXFILE_HASHBYTES)
+	{
+#ifdef _WIN32
+		_fseeki64(file, -INDEXFILE_HASHBYTES, SEEK_END);
+#else
+		fseeko(file, -INDEXFILE_HASHBYTES, SEEK_END);
+#endif
+		read = fread(buffer, 1, INDEXFILE_HASHBYTES, file);
+		h = hashBytes(h, buffer, read);
+	}
+
+	free(buffer);
+	fclose(file);
+	*hash = h;
+	return true;
+}
+
+inline void indexFilePath(char *path, size_t pathSize, const char *filename)
+{
+	snprintf(path, pathSize, "%s%s", filename, INDEXFILE_EXTENSION);
+}
+
+inline uint64 alignIndexOffset(uint64 offset)
+{
+	return (offset + 7) & ~(uint64)7;
+}
+
+// Loads the index of the video from its sidecar. Returns false (and leaves the index alone) if
+// there is no sidecar or it is stale, in which case the video has to be probed.
+bool loadFrameIndex(VideoFile *vfile, const char *filename)
+{
+	uint64 start = (uint64)SDL_GetTicks();
+
+	uint64 size, hash;
+	int64 mtime;
+	if(!getVideoFileSignature(filename, &size, &mtime, &hash)) return false;
+
+	char path[1024];
+	indexFilePath(path, sizeof(path), filename);
+
+	MappedFile mf;
+	if(!mapFile(&mf, path)) return false;
+
+	bool valid = mf.size >= sizeof(IndexFileHeader);
+	IndexFileHeader *header = (IndexFileHeader *)mf.data;
+	if(valid)
+	{
+		valid = memcmp(header->magic, INDEXFILE_MAGIC, sizeof(INDEXFILE_MAGIC)) == 0 &&
+		        header->version == INDEXFILE_VERSION &&
+		        header->headerSize == sizeof(IndexFileHeader) &&
+		        header->fileSize == size &&
+		        header->fileMtime == mtime &&
+		        header->contentHash == hash &&
+		        header->streamIndex == vfile->streamIndex;
+	}
+	if(valid)
+	{
+		uint64 n64 = (uint64)header->nframes * sizeof(int64);
+		uint64 n32 = (uint64)header->nframes * sizeof(int32);
+		valid = header->ptsOffset + n64 <= mf.size &&
+		        header->dtsOffset + n64 <= mf.size &&
+		        header->parentKeyframeOffset + n32 <= mf.size &&
+		        header->decodeToDisplayOffset + n32 <= mf.size &&
+		        header->posOffset + n64 <= mf.size &&
+		        header->sizeOffset + n32 <= mf.size &&
+		        header->displayPtsOffset + n64 <= mf.size &&
+		        header->displayToDecodeOffset + n32 <= mf.size &&
+		        header->keyframesOffset + (uint64)header->nkeyframes * sizeof(int32) <= mf.size;
+	}
+	if(!valid)
+	{
+		printf("Frame index %s is stale, reprobing.\n", path);
+		unmapFile(&mf);
+		return false;
+	}
+
+	vfile->indexFile = mf;
+	FrameIndex *index = &vfile->index;
+	index->pts = (int64 *)(mf.data + header->ptsOffset);
+	index->dts = (int64 *)(mf.data + header->dtsOffset);
+	index->parentKeyframe = (int32 *)(mf.data + header->parentKeyframeOffset);
+	index->decodeToDisplay = (int32 *)(mf.data + header->decodeToDisplayOffset);
+	index->pos = (int64 *)(mf.data + header->posOffset);
+	index->size = (int32 *)(mf.data + header->sizeOffset);
+	index->displayPts = (int64 *)(mf.data + header->displayPtsOffset);
+	index->displayToDecode = (int32 *)(mf.data + header->displayToDecodeOffset);
+	index->keyframes = (int32 *)(mf.data + header->keyframesOffset);
+	index->capacity = header->nframes;
+	vfile->nframes = header->nframes;
+	vfile->nkeyframes = header->nkeyframes;
+	vfile->maxGopLength = header->maxGopLength;
+
+	uint64 end = (uint64)SDL_GetTicks();
+	printTiming("loading frame index", end - start);
+	return true;
+}
+
+internal bool writeIndexArray(FILE *file, uint64 offset, const void *data, size_t size)
+{
+	static const uint8 padding[8] = {};
+	long pos = ftell(file);
+	if(pos < 0 || (uint64)pos > offset) return false;
+	if(fwrite(padding, 1, (size_t)(offset - pos), file) != (size_t)(offset - pos)) return false;
+	return fwrite(data, 1, size, file) == size;
+}
+
+// Saves the index of a probed video to its sidecar. Failing to save is not an error, the video
+// will just be probed again next time.
+void saveFrameIndex(VideoFile *vfile, const char *filename)
+{
+	IndexFileHeader header = {};
+	memcpy(header.magic, INDEXFILE_MAGIC, sizeof(INDEXFILE_MAGIC));
+	header.version = INDEXFILE_VERSION;
+	header.headerSize = sizeof(IndexFileHeader);
+	if(!getVideoFileSignature(filename, &header.fileSize, &header.fileMtime, &header.contentHash))
+	{
+		return;
+	}
+	header.streamIndex = vfile->streamIndex;
+	header.nframes = vfile->nframes;
+	header.nkeyframes = vfile->nkeyframes;
+	header.maxGopLength = vfile->maxGopLength;
+
+	FrameIndex *index = &vfile->index;
+	size_t n64 = vfile->nframes * sizeof(int64);
+	size_t n32 = vfile->nframes * sizeof(int32);
+	size_t keyframesSz = vfile->nkeyframes * sizeof(int32);
+	header.ptsOffset = alignIndexOffset(sizeof(IndexFileHeader));
+	header.dtsOffset = alignIndexOffset(header.ptsOffset + n64);
+	header.parentKeyframeOffset = alignIndexOffset(header.dtsOffset + n64);
+	header.decodeToDisplayOffset = alignIndexOffset(header.parentKeyframeOffset + n32);
+	header.posOffset = alignIndexOffset(header.decodeToDisplayOffset + n32);
+	header.sizeOffset = alignIndexOffset(header.posOffset + n64);
+	header.displayPtsOffset = alignIndexOffset(header.sizeOffset + n32);
+	header.displayToDecodeOffset = alignIndexOffset(header.displayPtsOffset + n64);
+	header.keyframesOffset = alignIndexOffset(header.displayToDecodeOffset + n32);
+
+	char path[1024];
+	indexFilePath(path, sizeof(path), filename);
+
+	FILE *file = fopen(path, "wb");
+	if(!file)
+	{
+		printf("Could not write frame index %s\n", path);
+		return;
+	}
+
+	bool ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+	          writeIndexArray(file, header.ptsOffset, index->pts, n64) &&
+	          writeIndexArray(file, header.dtsOffset, index->dts, n64) &&
+	          writeIndexArray(file, header.parentKeyframeOffset, index->parentKeyframe, n32) &&
+	          writeIndexArray(file, header.decodeToDisplayOffset, index->decodeToDisplay, n32) &&
+	          writeIndexArray(file, header.posOffset, index->pos, n64) &&
+	          writeIndexArray(file, header.sizeOffset, index->size, n32) &&
+	          writeIndexArray(file, header.displayPtsOffset, index->displayPts, n64) &&
+	          writeIndexArray(file, header.displayToDecodeOffset, index->displayToDecode, n32) &&
+	          writeIndexArray(file, header.keyframesOffset, index->keyframes, keyframesSz);
+	fclose(file);
+
+	if(!ok)
+	{
+		printf("Could not write frame index %s\n", path);
+		remove(path);
+	}
+}
+
+#endif
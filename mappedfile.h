@@ -0,0 +1,100 @@
+#ifndef MAPPEDFILE_H
+#define MAPPEDFILE_H
+
+// NOTE: Read-only memory mapping of a whole file. The pages are only read in by the OS when they
+// are touched, so mapping a large file is (almost) free.
+struct MappedFile
+{
+	uint8  *data = NULL;
+	uint64  size = 0;
+#ifdef _WIN32
+	HANDLE  file    = INVALID_HANDLE_VALUE;
+	HANDLE  mapping = NULL;
+#else
+	int     fd      = -1;
+#endif
+};
+
+#ifdef _WIN32
+
+bool mapFile(MappedFile *mf, const char *filename)
+{
+	*mf = MappedFile();
+	mf->file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+	                       FILE_ATTRIBUTE_NORMAL, NULL);
+	if(mf->file == INVALID_HANDLE_VALUE) return false;
+
+	LARGE_INTEGER size;
+	if(!GetFileSizeEx(mf->file, &size) || size.QuadPart == 0)
+	{
+		CloseHandle(mf->file);
+		mf->file = INVALID_HANDLE_VALUE;
+		return false;
+	}
+	mf->size = (uint64)size.QuadPart;
+
+	mf->mapping = CreateFileMappingA(mf->file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if(mf->mapping)
+	{
+		mf->data = (uint8 *)MapViewOfFile(mf->mapping, FILE_MAP_READ, 0, 0, 0);
+	}
+	if(!mf->data)
+	{
+		if(mf->mapping) CloseHandle(mf->mapping);
+		CloseHandle(mf->file);
+		*mf = MappedFile();
+		return false;
+	}
+	return true;
+}
+
+void unmapFile(MappedFile *mf)
+{
+	if(mf->data) UnmapViewOfFile(mf->data);
+	if(mf->mapping) CloseHandle(mf->mapping);
+	if(mf->file != INVALID_HANDLE_VALUE) CloseHandle(mf->file);
+	*mf = MappedFile();
+}
+
+#else
+
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+bool mapFile(MappedFile *mf, const char *filename)
+{
+	*mf = MappedFile();
+	mf->fd = open(filename, O_RDONLY);
+	if(mf->fd < 0) return false;
+
+	struct stat st;
+	if(fstat(mf->fd, &st) != 0 || st.st_size == 0)
+	{
+		close(mf->fd);
+		*mf = MappedFile();
+		return false;
+	}
+	mf->size = (uint64)st.st_size;
+
+	void *data = mmap(NULL, mf->size, PROT_READ, MAP_SHARED, mf->fd, 0);
+	if(data == MAP_FAILED)
+	{
+		close(mf->fd);
+		*mf = MappedFile();
+		return false;
+	}
+	mf->data = (uint8 *)data;
+	return true;
+}
+
+void unmapFile(MappedFile *mf)
+{
+	if(mf->data) munmap(mf->data, mf->size);
+	if(mf->fd >= 0) close(mf->fd);
+	*mf = MappedFile();
+}
+
+#endif // _WIN32
+
+#endif // MAPPEDFILE_H
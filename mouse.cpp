@@ -3,9 +3,11 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdarg.h>
+#include <string.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <assert.h>
+#include <immintrin.h>
 
 #include "resource.h"
 
@@ -19,6 +21,7 @@ extern "C"
 	#include <libavformat/avformat.h>
 	#include <libswscale/swscale.h>
 	#include <libavutil/avconfig.h>
+	#include <libavutil/imgutils.h>
 	#include <libswresample/swresample.h>
 }
 
@@ -55,11 +58,35 @@ global SDL_AudioSpec Global_AudioSpec = {};
 #include "ui.h"
 #include "video.h"
 #include "audio.h"
+#include "playback.h"
+#include "seek.h"
+#include "scrub.h"
+#include "prefetch.h"
+#include "reverse.h"
+#include "softpresent.h"
+#include "text.h"
+#include "redraw.h"
+#include "calibrate.h"
 
 global ViewRects Global_views = {};
 
-global VideoFile Global_videoFile = {};
-global VideoClip Global_videoClip = {};
+global VideoFile  Global_videoFile  = {};
+global VideoClip  Global_videoClip  = {};
+global Playback   Global_playback   = {};
+global SeekEngine Global_seekEngine = {};
+global ScrubCache Global_scrubCache = {};
+global Prefetcher Global_prefetcher = {};
+global ReversePlayback Global_reverse = {};
+global ThreadingOverride  Global_threadingOverride = {};
+global ThreadCalibrations Global_threadCalibrations = {};
+global SoftPresenter Global_softPresenter = {};
+global bool Global_forceSoftware = false;
+global int  Global_prefetchThreads = PREFETCH_DEFAULT_THREADS; // --prefetch-threads=N
+global RedrawState Global_redraw = {};
+
+global int    Global_scrubSettleFrame = -1; // Frame to decode in full once the drag rests
+global uint32 Global_scrubMoveTicks   = 0;
+global bool   Global_scrubResume      = false; // Play on once the timeline drag is over
 
 struct Mouse
 {
@@ -76,21 +103,51 @@ inline Mouse createMouse()
 	return mouse;
 }
 
+// Hands the clip's decoder back to the main thread: stops the playback thread and cancels any seek
+// that is still running. Call this before decoding anything on the main thread.
+internal void takeDecoder()
+{
+	stopReversePlayback(&Global_reverse);
+	stopPlayback(&Global_playback);
+	cancelSeeks(&Global_seekEngine);
+	Global_scrubCache.showing = false;
+	Global_scrubSettleFrame = -1;
+}
+
+// Replaces the clip (if there is one) with the given file and everything that plays it.
 internal void newClip(const char *name)
 {
 	Global_playIndex = 0;
-	freeVideoClip(&Global_videoClip);
-	freeVideoFile(&Global_videoFile);
+	if(Global_videoClip.vfile)
+	{
+		freeReversePlayback(&Global_reverse);
+		freePrefetcher(&Global_prefetcher);
+		freeScrubCache(&Global_scrubCache);
+		freeSeekEngine(&Global_seekEngine);
+		freePlayback(&Global_playback);
+		freeVideoClip(&Global_videoClip);
+		freeVideoFile(&Global_videoFile);
+	}
 	loadVideoFile(&Global_videoFile, Global_renderer, name);
+	setupDecodeThreading(&Global_videoFile, &Global_threadingOverride, &Global_threadCalibrations);
 	printVideoFileInfo(Global_videoFile);
 	createVideoClip(&Global_videoClip, &Global_videoFile, Global_renderer, Global_clipNumbers++);
+	enableSoftPresentation(&Global_softPresenter, &Global_videoClip);
 	printVideoClipInfo(Global_videoClip);
+	createPlayback(&Global_playback, &Global_videoClip, PLAYBACK_QUEUE_DEPTH);
+	createSeekEngine(&Global_seekEngine, &Global_videoClip);
+	createScrubCache(&Global_scrubCache, &Global_videoClip, Global_renderer);
+	createReversePlayback(&Global_reverse, &Global_videoClip);
+	createPrefetcher(&Global_prefetcher, &Global_videoClip,
+	                 Global_prefetchThreads, PREFETCH_MAX_GOPS);
+	// MUST Layout Window Elements so the video and scrubber are in the correct place
 	layoutWindowElements(Global_window, &Global_views, &Global_videoClip, Global_playIndex);
 }
 
 void seek_initial(int amount)
 {
 	Global_paused = true;
+	takeDecoder();
 	Global_seekIndex = Global_playIndex;
 	int index = Global_playIndex + amount;
 	if(index > Global_videoClip.endFrame) index = Global_videoClip.endFrame;
@@ -106,11 +163,13 @@ void seek_initial(int amount)
 // clips. This is not really a problem right now as the code to do this is really only for testing.
 // Remember, however, any time a new clip is loaded the rectangles for the composite view and
 // current views must be updated so it can resize the clip's aspect ratio correctly.
-internal void HandleEvents(Mouse *mouse, SDL_Event event, VideoClip *clip, char **fname)
+//
+// Blocks for up to timeout ms until there is an event, then handles every event that is queued.
+internal void HandleEvents(Mouse *mouse, SDL_Event event, VideoClip *clip, char **fname, int timeout)
 {
-	SDL_PumpEvents();
+	bool gotEvent = SDL_WaitEventTimeout(&event, timeout) != 0;
 	SDL_GetMouseState(&mouse->x, &mouse->y);
-	if(SDL_PollEvent(&event))
+	while(gotEvent)
 	{
 		if(event.type == SDL_QUIT) Global_running = false;
 		if(event.type == SDL_MOUSEMOTION)
@@ -125,11 +184,24 @@ internal void HandleEvents(Mouse *mouse, SDL_Event event, VideoClip *clip, char
 					int wantedFrame = (float)clip->endFrame * percent;
 					if(wantedFrame < 0) wantedFrame = 0;
 					if(wantedFrame > clip->endFrame) wantedFrame = clip->endFrame;
-					if(seekToAnyFrame(&Global_videoClip, wantedFrame))
+					// Seeks run on the seek thread, the newest one wins. The playhead moves right away,
+					// the frame follows as soon as it is decoded at draft quality. If there is a scrub
+					// image for the frame it is shown instead. Either way the full quality frame waits
+					// until the drag settles.
+					stopPlayback(&Global_playback);
+					stopReversePlayback(&Global_reverse);
+					Global_playIndex = wantedFrame;
+					setScrubberXPosition(Global_videoClip, &Global_views, Global_playIndex);
+					if(showScrubImage(&Global_scrubCache, wantedFrame))
+					{
+						dropSeeks(&Global_seekEngine);
+					}
+					else
 					{
-						Global_playIndex = wantedFrame;
-						setScrubberXPosition(Global_videoClip, &Global_views, Global_playIndex);
+						postSeek(&Global_seekEngine, wantedFrame, DecodeQuality_Draft);
 					}
+					Global_scrubSettleFrame = wantedFrame;
+					Global_scrubMoveTicks = SDL_GetTicks();
 				}
 			}
 		}
@@ -138,6 +210,14 @@ internal void HandleEvents(Mouse *mouse, SDL_Event event, VideoClip *clip, char
 			mouse->down = true;
 			mouse->click.x = mouse->x;
 			mouse->click.y = mouse->y;
+			// Playback is paused for the whole drag so it can't take the clip's decoder from the
+			// seek thread, it goes on from the released frame afterwards
+			if(SDL_PointInRect(&mouse->click, &Global_videoClip.tlRect))
+			{
+				Global_scrubResume = !Global_paused;
+				Global_paused = true;
+				stopPlayback(&Global_playback);
+			}
 			Global_origVideoPoint.x = Global_videoClip.videoRect.x;
 			Global_origVideoPoint.y = Global_videoClip.videoRect.y;
 		}
@@ -150,11 +230,15 @@ internal void HandleEvents(Mouse *mouse, SDL_Event event, VideoClip *clip, char
 				int wantedFrame = (float)clip->endFrame * percent;
 				if(wantedFrame < 0) wantedFrame = 0;
 				if(wantedFrame > clip->endFrame) wantedFrame = clip->endFrame;
-				if(seekToAnyFrame(&Global_videoClip, wantedFrame))
-				{
-					Global_playIndex = wantedFrame;
-					setScrubberXPosition(Global_videoClip, &Global_views, Global_playIndex);
-				}
+				stopPlayback(&Global_playback);
+				stopReversePlayback(&Global_reverse);
+				postSeek(&Global_seekEngine, wantedFrame, DecodeQuality_Full);
+				Global_scrubSettleFrame = -1;
+				Global_playIndex = wantedFrame;
+				setScrubberXPosition(Global_videoClip, &Global_views, Global_playIndex);
+				// Playback starts again once the seek is done (see the main loop)
+				Global_paused = !Global_scrubResume;
+				Global_scrubResume = false;
 			}
 			mouse->click.x = -1;
 			mouse->click.y = -1;
@@ -170,18 +254,41 @@ internal void HandleEvents(Mouse *mouse, SDL_Event event, VideoClip *clip, char
 				} break;
 				case SDLK_SPACE:
 				{
-					if(!Global_paused) Global_paused = true;
+					if(Global_reverse.active) stopReversePlayback(&Global_reverse);
+					else if(!Global_paused) Global_paused = true;
 					else Global_paused = false;
 				} break;
+				case SDLK_j:
+				{
+					// Every press plays backwards twice as fast
+					if(!Global_reverse.active)
+					{
+						Global_paused = true;
+						stopPlayback(&Global_playback);
+						cancelSeeks(&Global_seekEngine);
+					}
+					startReversePlayback(&Global_reverse, Global_playIndex);
+				} break;
+				case SDLK_k:
+				{
+					stopReversePlayback(&Global_reverse);
+					Global_paused = true;
+				} break;
 				case SDLK_RIGHT:
 				case SDLK_f:
 				{
+					// Shown right away from the warm decoder, so holding the key steps through the
+					// frames at the key repeat rate.
 					seek_initial(1);
+					stepForwardToFrame(&Global_videoClip, Global_playIndex);
 				} break;
 				case SDLK_LEFT:
 				case SDLK_d:
 				{
+					// Show every step right away so holding the key jogs backwards through the
+					// buffered GOP.
 					seek_initial(-1);
+					stepBackToFrame(&Global_videoClip, Global_playIndex);
 				} break;
 				case SDLK_r:
 				case SDLK_UP:
@@ -223,8 +330,6 @@ internal void HandleEvents(Mouse *mouse, SDL_Event event, VideoClip *clip, char
 			SDL_Keycode key = event.key.keysym.sym;
 			switch(key)
 			{
-				case SDLK_RIGHT:
-				case SDLK_f:
 				case SDLK_LEFT:
 				case SDLK_d:
 				case SDLK_r:
@@ -234,7 +339,9 @@ internal void HandleEvents(Mouse *mouse, SDL_Event event, VideoClip *clip, char
 				case SDLK_HOME:
 				case SDLK_END:
 				{
-					seekToAnyFrame(&Global_videoClip, Global_playIndex);
+					takeDecoder();
+					if(Global_playIndex < Global_seekIndex) stepBackToFrame(&Global_videoClip, Global_playIndex);
+					else seekToAnyFrameCached(&Global_videoClip, Global_playIndex);
 				} break;
 			}
 		}
@@ -256,6 +363,11 @@ internal void HandleEvents(Mouse *mouse, SDL_Event event, VideoClip *clip, char
 				case SDL_WINDOWEVENT_FOCUS_LOST:
 				{
 					Global_paused = true;
+					Global_scrubResume = false;
+				} break;
+				case SDL_WINDOWEVENT_EXPOSED:
+				{
+					markDirty(&Global_redraw, DirtyRegion_All);
 				} break;
 			}
 		}
@@ -263,25 +375,15 @@ internal void HandleEvents(Mouse *mouse, SDL_Event event, VideoClip *clip, char
 		{
 			// TODO Fix drag and drop up so there are no more crashes.
 			*fname = event.drop.file;
-			Global_playIndex = 0;
-
-			freeVideoClip(&Global_videoClip);
-			freeVideoFile(&Global_videoFile);
-
-			loadVideoFile(&Global_videoFile, Global_renderer, *fname);
-			printVideoFileInfo(Global_videoFile);
-			createVideoClip(&Global_videoClip, &Global_videoFile, Global_renderer, Global_clipNumbers++);
-			printVideoClipInfo(Global_videoClip);
-			// MUST Layout Window Elements so the video and scrubber are in the correct place
-			layoutWindowElements(Global_window, &Global_views, &Global_videoClip, Global_playIndex);
+			newClip(*fname);
 		}
+		gotEvent = SDL_PollEvent(&event) != 0;
 	}
 }
 
 void WaitForDroppedFileEvent(SDL_Event event, char **fname, bool *gotFile)
 {
-	SDL_PumpEvents();
-	if(SDL_PollEvent(&event))
+	if(SDL_WaitEventTimeout(&event, REDRAW_IDLE_MS))
 	{
 		switch(event.type)
 		{
@@ -317,9 +419,6 @@ int main(int argc, char **argv)
 	                                 Global_screenWidth, Global_screenHeight, 
 	                                 SDL_WINDOW_OPENGL|SDL_WINDOW_RESIZABLE
 	                                 |SDL_WINDOW_MAXIMIZED);
-	int windowWidth, windowHeight;
-
-	Global_renderer = SDL_CreateRenderer(Global_window, -1, SDL_RENDERER_ACCELERATED);
 
 	SDL_Event event = {};
 
@@ -329,12 +428,38 @@ int main(int argc, char **argv)
 	Global_screenRect.h = Global_screenHeight;
 
 	char *fname = "";
-	// If we have an argument then we try to use it as a filename, otherwise we go to the loop.
-	if(argv[1]) fname = argv[1];
-	else
+	// Options start with "--", the first argument that isn't one is taken as the filename.
+	for(int i = 1; i < argc; ++i)
+	{
+		if(strncmp(argv[i], "--", 2) == 0)
+		{
+			if(strcmp(argv[i], "--software") == 0)
+			{
+				Global_forceSoftware = true;
+			}
+			else if(strncmp(argv[i], "--prefetch-threads=", 19) == 0)
+			{
+				// Clamped to the cores there are by createPrefetcher(), 0 turns prefetching off
+				Global_prefetchThreads = atoi(argv[i] + 19);
+			}
+			else if(!parseThreadingOption(argv[i], &Global_threadingOverride))
+			{
+				printf("Unknown option: %s\n", argv[i]);
+				printf("Usage: mouse [--threads=N[,frame|slice|frame+slice|none]] "
+				       "[--seek-threads=...] [--playback-threads=...] [--prefetch-threads=N] "
+				       "[--software] [file]\n");
+			}
+		}
+		else if(!*fname) fname = argv[i];
+	}
+
+	Global_renderer = createRendererWithSoftPresenter(&Global_softPresenter, Global_window,
+	                                                  Global_forceSoftware);
+	// If we have a filename then we try to use it, otherwise we go to the loop.
+	if(!*fname)
 	{
 		bool gotFile = false;
-		// We didn't get a file from argv[1] so open the window and render it and wait for a file
+		// We didn't get a file from the arguments so open the window and render it and wait for a file
 		// to be dropped on the window.
 		while(!gotFile && Global_running)
 		{
@@ -354,12 +479,7 @@ int main(int argc, char **argv)
 	}
 
 	// Global_AudioDeviceID = initAudioDevice(Global_AudioSpec); WARNING XXX FIXME Breaks SDL_Quit
-	loadVideoFile(&Global_videoFile, Global_renderer, fname); 
-	printVideoFileInfo(Global_videoFile);
-	createVideoClip(&Global_videoClip, &Global_videoFile, Global_renderer, Global_clipNumbers++);
-	printVideoClipInfo(Global_videoClip);
-	// MUST Layout Window Elements so the video and scrubber are in the correct place
-	layoutWindowElements(Global_window, &Global_views, &Global_videoClip, Global_playIndex);
+	newClip(fname);
 
 	TTF_Init();
 
@@ -371,6 +491,8 @@ int main(int argc, char **argv)
 
 	TTF_Font *fontDroidSansMono24 = TTF_OpenFont("../res/fonts/DroidSansMono.ttf", 24);
 	TTF_Font *fontDroidSansMono32 = TTF_OpenFont("../res/fonts/DroidSansMono.ttf", 32);
+	TextRenderer hudText;
+	createTextRenderer(&hudText, Global_renderer, fontDroidSansMono24);
 
 	SDL_Surface *playIndexSurface;
 	SDL_Surface *filenameSurface;
@@ -383,150 +505,293 @@ int main(int argc, char **argv)
 	int startTicks = SDL_GetTicks();
 	while(Global_running)
 	{
-		HandleEvents(&mouse, event, &Global_videoClip, &fname);
+		// Nothing on screen changes until there is an event, the next frame is due or a thread has
+		// a result to pick up, so the loop sleeps until then
+		float msUntilFrame = -1.0f;
+		if(Global_reverse.active || (!Global_paused && Global_playback.active))
+		{
+			msUntilFrame = (Global_videoClip.vfile->msperframe * 0.95f) - 
+				(ticksElapsed + (float)(SDL_GetTicks() - startTicks));
+			if(msUntilFrame < 0.0f) msUntilFrame = 0.0f;
+		}
+		bool busy = !seekEngineIdle(&Global_seekEngine) || Global_scrubSettleFrame >= 0 ||
+			(Global_paused && Global_videoClip.reversePrefetchGop >= 0) ||
+			(!Global_paused && !Global_playback.active);
+		int wait = redrawWaitMs(msUntilFrame, busy, !Global_videoClip.indexComplete);
+		HandleEvents(&mouse, event, &Global_videoClip, &fname, wait);
 
-		SDL_GetWindowSize(Global_window, &windowWidth, &windowHeight);
+		if(mouse.down)
+		{
+			SDL_Point p = {mouse.x, mouse.y};
+			if(SDL_PointInRect(&p, &Global_views.background))
+			{
+				Global_videoClip.videoRect.x = Global_origVideoPoint.x + (mouse.x - mouse.click.x);
+				Global_videoClip.videoRect.y = Global_origVideoPoint.y + (mouse.y - mouse.click.y);
+			}
+		}
 
-		SDL_SetRenderDrawColor(Global_renderer, 
-		                       tcBackground.r, 
-		                       tcBackground.g, 
-		                       tcBackground.b, 
-		                       tcBackground.a);
-		SDL_RenderClear(Global_renderer);
+		// Finishing the index may resize the frame cache, which belongs to whoever owns the decoder
+		if(!Global_videoClip.indexComplete && frameIndexReady(Global_videoClip.vfile)) takeDecoder();
+		if(updateVideoClipIndex(&Global_videoClip))
+		{
+			layoutWindowElements(Global_window, &Global_views, &Global_videoClip, Global_playIndex);
+		}
 
-		setRenderColor(Global_renderer, tcBlack);
-		SDL_RenderFillRect(Global_renderer, &Global_views.background);
+		// Frames are converted at the size they are shown at and only the visible part is uploaded.
+		// When zooming, panning or the layout changed either, the frame on screen is shown again (it
+		// normally comes from the frame cache).
+		if(setDisplayView(&Global_videoClip, &Global_videoClip.videoRect, &Global_views.background) &&
+		   Global_paused && !Global_reverse.active && !Global_scrubCache.showing)
+		{
+			postSeek(&Global_seekEngine, Global_playIndex, DecodeQuality_Full);
+		}
 
-		//setRenderColor(Global_renderer, tcView);
-		//SDL_RenderFillRect(Global_renderer, &Global_views.timeline);
 		#if 1
-		if(!Global_paused)
+		// Decoding happens on the playback threads (see playback.h and reverse.h), here we only pick
+		// up the next ready frame when it is due.
+		if(Global_reverse.active)
 		{
 			int endTicks = SDL_GetTicks();
 			ticksElapsed += (float)endTicks - (float)startTicks;
 			if(ticksElapsed >= 
 			   (Global_videoClip.vfile->msperframe - (Global_videoClip.vfile->msperframe * 0.05f)))
 			{
-				int res = decodeSingleFrame(&Global_videoClip);
-				if(res > 0)
+				int index = presentNextReverseFrame(&Global_reverse);
+				if(index >= 0)
 				{
-					updateVideoClipTexture(&Global_videoClip);
-					Global_playIndex++;
+					Global_scrubCache.showing = false;
+					Global_playIndex = index;
 					setScrubberXPosition(Global_videoClip, &Global_views, Global_playIndex);
+					ticksElapsed = 0;
 				}
-				else
+				else if(reversePlaybackFinished(&Global_reverse))
+				{
+					stopReversePlayback(&Global_reverse);
+				}
+			}
+		}
+		else if(!Global_paused)
+		{
+			// Let a seek that is still running finish before playing on from it
+			if(!Global_playback.active && seekEngineIdle(&Global_seekEngine))
+			{
+				startPlayback(&Global_playback, Global_playIndex);
+			}
+
+			int endTicks = SDL_GetTicks();
+			ticksElapsed += (float)endTicks - (float)startTicks;
+			if(Global_playback.active && ticksElapsed >= 
+			   (Global_videoClip.vfile->msperframe - (Global_videoClip.vfile->msperframe * 0.05f)))
+			{
+				int index = presentNextPlaybackFrame(&Global_playback);
+				if(index >= 0)
+				{
+					Global_scrubCache.showing = false;
+					Global_playIndex = index;
+					setScrubberXPosition(Global_videoClip, &Global_views, Global_playIndex);
+					ticksElapsed = 0;
+				}
+				else if(playbackFinished(&Global_playback))
 				{
 					Global_flush = true;
+					Global_paused = true;
 				}
-				ticksElapsed = 0;
 			}
 		}
+		else
+		{
+			stopPlayback(&Global_playback);
+		}
 		startTicks = SDL_GetTicks();
 		#endif
 
-		int filenameTextHeight;
-		TTF_SizeText(fontDroidSansMono24, Global_videoClip.filename, NULL, &filenameTextHeight);
-		int fnameTextX = Global_views.background.x;
-		int fnameTextY = Global_views.background.y - filenameTextHeight - 8;
-		DrawText(Global_renderer, fontDroidSansMono24, fnameTextX, fnameTextY, 
-		         Global_videoClip.filename, SDLC_white);
-
-		int playHeadW;
-		char playheadTextBuffer[32];
-		sprintf(playheadTextBuffer, "%d", Global_playIndex);
-		TTF_SizeText(fontDroidSansMono24, playheadTextBuffer, &playHeadW, NULL);
-		int playHeadX = Global_views.scrubber.x - (playHeadW / 2);
-		int playHeadY = Global_views.scrubber.y + Global_views.scrubber.h;
-		DrawText(Global_renderer, fontDroidSansMono24, playHeadX, playHeadY,
-		         playheadTextBuffer, SDLC_white);
-
-		// < DEBUG
-		#if 0
-		char ticksElapsedBuffer[32];
-		if(ticksElapsed < 10.0f) sprintf(ticksElapsedBuffer, "Ticks:  %.4f", ticksElapsed);
-		else sprintf(ticksElapsedBuffer, "Ticks: %.4f", ticksElapsed);
-		if(ticksElapsedSurface = TTF_RenderText_Blended(fontDroidSansMono24,
-		                                                ticksElapsedBuffer, SDLC_white))
+		// The drag has rested long enough, decode the full frame under the scrub image or draft
+		if(Global_scrubSettleFrame >= 0 && SDL_GetTicks() - Global_scrubMoveTicks >= SCRUB_SETTLE_MS)
 		{
-			int w;
-			TTF_SizeText(fontDroidSansMono24, "Ticks: 00.0000", &w, NULL);
-			SDL_Rect ticksElapsedRect;
-			ticksElapsedRect.w = ticksElapsedSurface->w;
-			ticksElapsedRect.h = ticksElapsedSurface->h;
-			ticksElapsedRect.x = Global_views.background.x + 
-				Global_views.background.w - w;
-			ticksElapsedRect.y = Global_views.background.y - ticksElapsedRect.h;
-
-			SDL_Texture *ticksElapsedTexture = SDL_CreateTextureFromSurface(Global_renderer, 
-			                                                                ticksElapsedSurface);
-			SDL_RenderCopy(Global_renderer, ticksElapsedTexture, NULL, &ticksElapsedRect);
-			SDL_DestroyTexture(ticksElapsedTexture);
-			SDL_FreeSurface(ticksElapsedSurface);
+			stopPlayback(&Global_playback);
+			stopReversePlayback(&Global_reverse);
+			postSeek(&Global_seekEngine, Global_scrubSettleFrame, DecodeQuality_Full);
+			Global_scrubSettleFrame = -1;
 		}
-		#endif
-		// > DEBUG
-
-		// < DEBUG
-		#if 0
-		char mousePosBuffer[32];
-		sprintf(mousePosBuffer, "Mouse: (%d,%d)", Global_mousex, Global_mousey);
-		if(mousePosSurface = TTF_RenderText_Blended(fontDroidSansMono24, mousePosBuffer, SDLC_white))
+		if(presentSeekResult(&Global_seekEngine) >= 0) Global_scrubCache.showing = false;
+		SDL_AtomicSet(&Global_scrubCache.playhead, Global_playIndex);
+		updatePrefetch(&Global_prefetcher, Global_playIndex, !Global_paused || Global_reverse.active);
+
+		// Only draw when something on screen changed since the last frame that was drawn
+		SDL_Texture *videoTexture = Global_scrubCache.showing ? 
+			Global_scrubCache.texture : Global_videoClip.shownTexture;
+		SDL_Point mousePoint = {mouse.x, mouse.y};
+		if(updateRedrawState(&Global_redraw, Global_window, &Global_videoClip, &Global_views,
+		                     videoTexture, Global_playIndex, mousePoint, mouse.click))
 		{
-			SDL_Rect mousePosRect;
-			mousePosRect.w = mousePosSurface->w;
-			mousePosRect.h = mousePosSurface->h;
-			mousePosRect.x = 8;
-			mousePosRect.y = 2;
+			SDL_SetRenderDrawColor(Global_renderer, 
+			                       tcBackground.r, 
+			                       tcBackground.g, 
+			                       tcBackground.b, 
+			                       tcBackground.a);
+			SDL_RenderClear(Global_renderer);
 
-			SDL_Texture *mousePosTexture = SDL_CreateTextureFromSurface(Global_renderer, mousePosSurface);
+			setRenderColor(Global_renderer, tcBlack);
+			SDL_RenderFillRect(Global_renderer, &Global_views.background);
+
+			//setRenderColor(Global_renderer, tcView);
+			//SDL_RenderFillRect(Global_renderer, &Global_views.timeline);
+
+			int filenameTextHeight;
+			textLabelSize(&hudText, Global_videoClip.filename, NULL, &filenameTextHeight);
+			int fnameTextX = Global_views.background.x;
+			int fnameTextY = Global_views.background.y - filenameTextHeight - 8;
+			drawLabel(&hudText, fnameTextX, fnameTextY, Global_videoClip.filename, SDLC_white);
+
+			char playheadTextBuffer[32];
+			sprintf(playheadTextBuffer, "%d", Global_playIndex);
+			int playHeadW = textWidth(&hudText, playheadTextBuffer);
+			int playHeadX = Global_views.scrubber.x - (playHeadW / 2);
+			int playHeadY = Global_views.scrubber.y + Global_views.scrubber.h;
+			drawText(&hudText, playHeadX, playHeadY, playheadTextBuffer, SDLC_white);
+
+			// Quality tier of the frame on screen, anything below full is replaced once the drag is
+			// over
+			const char *tierText = "FULL";
+			SDL_Color tierColor = SDLC_green;
+			if(Global_scrubCache.showing)
+			{
+				tierText = "SCRUB";
+				tierColor = SDLC_red;
+			}
+			else if(Global_videoClip.shownQuality == DecodeQuality_Draft)
+			{
+				tierText = "DRAFT";
+				tierColor = SDLC_yellow;
+			}
+			int tierTextW, tierTextH;
+			textLabelSize(&hudText, tierText, &tierTextW, &tierTextH);
+			drawLabel(&hudText, Global_views.background.x + Global_views.background.w - tierTextW,
+			          Global_views.background.y - tierTextH - 8, tierText, tierColor);
+
+			// < DEBUG
+			#if 0
+			char ticksElapsedBuffer[32];
+			if(ticksElapsed < 10.0f) sprintf(ticksElapsedBuffer, "Ticks:  %.4f", ticksElapsed);
+			else sprintf(ticksElapsedBuffer, "Ticks: %.4f", ticksElapsed);
+			if(ticksElapsedSurface = TTF_RenderText_Blended(fontDroidSansMono24,
+			                                                ticksElapsedBuffer, SDLC_white))
+			{
+				int w;
+				TTF_SizeText(fontDroidSansMono24, "Ticks: 00.0000", &w, NULL);
+				SDL_Rect ticksElapsedRect;
+				ticksElapsedRect.w = ticksElapsedSurface->w;
+				ticksElapsedRect.h = ticksElapsedSurface->h;
+				ticksElapsedRect.x = Global_views.background.x + 
+					Global_views.background.w - w;
+				ticksElapsedRect.y = Global_views.background.y - ticksElapsedRect.h;
+
+				SDL_Texture *ticksElapsedTexture = SDL_CreateTextureFromSurface(Global_renderer, 
+				                                                                ticksElapsedSurface);
+				SDL_RenderCopy(Global_renderer, ticksElapsedTexture, NULL, &ticksElapsedRect);
+				SDL_DestroyTexture(ticksElapsedTexture);
+				SDL_FreeSurface(ticksElapsedSurface);
+			}
+			#endif
+			// > DEBUG
+
+			// < DEBUG
+			#if 0
+			char mousePosBuffer[32];
+			sprintf(mousePosBuffer, "Mouse: (%d,%d)", Global_mousex, Global_mousey);
+			if(mousePosSurface = TTF_RenderText_Blended(fontDroidSansMono24, mousePosBuffer, SDLC_white))
+			{
+				SDL_Rect mousePosRect;
+				mousePosRect.w = mousePosSurface->w;
+				mousePosRect.h = mousePosSurface->h;
+				mousePosRect.x = 8;
+				mousePosRect.y = 2;
 
-			SDL_RenderCopy(Global_renderer, mousePosTexture, NULL, &mousePosRect);
-			SDL_DestroyTexture(mousePosTexture);
-			SDL_FreeSurface(mousePosSurface);
-		}
-		#endif
-		// > DEBUG
+				SDL_Texture *mousePosTexture = SDL_CreateTextureFromSurface(Global_renderer, mousePosSurface);
 
-		SDL_RenderSetClipRect(Global_renderer, &Global_views.background);
-		SDL_RenderCopy(Global_renderer, Global_videoClip.texture, NULL, 
-		               (SDL_Rect *)&Global_videoClip.videoRect);
-		SDL_RenderSetClipRect(Global_renderer, NULL);
+				SDL_RenderCopy(Global_renderer, mousePosTexture, NULL, &mousePosRect);
+				SDL_DestroyTexture(mousePosTexture);
+				SDL_FreeSurface(mousePosSurface);
+			}
+			#endif
+			// > DEBUG
 
-		setRenderColor(Global_renderer, tcView);
-		SDL_RenderFillRect(Global_renderer, &Global_videoClip.tlRect);
+			if(Global_softPresenter.active && !Global_scrubCache.showing)
+			{
+				blitSoftVideo(&Global_softPresenter, &Global_videoClip, &Global_views.background);
+			}
+			else
+			{
+				SDL_RenderSetClipRect(Global_renderer, &Global_views.background);
+				if(Global_scrubCache.showing)
+				{
+					SDL_RenderCopy(Global_renderer, Global_scrubCache.texture, NULL,
+					               &Global_videoClip.videoRect);
+				}
+				else
+				{
+					SDL_Rect src, dst;
+					SDL_Rect *crop = shownTextureRects(&Global_videoClip, &src, &dst);
+					SDL_RenderCopy(Global_renderer, Global_videoClip.shownTexture, crop, &dst);
+				}
+				SDL_RenderSetClipRect(Global_renderer, NULL);
+			}
 
-		setRenderColor(Global_renderer, tcRed);
-		SDL_RenderFillRect(Global_renderer, &Global_views.scrubber);
+			setRenderColor(Global_renderer, tcView);
+			SDL_RenderFillRect(Global_renderer, &Global_videoClip.tlRect);
 
-		setRenderColor(Global_renderer, tcGreen);
-		SDL_Rect mouser = {mouse.x - 5, mouse.y - 5, 10, 10};
-		SDL_RenderFillRect(Global_renderer, &mouser);
+			// Show how far the indexing thread has got along the bottom of the timeline
+			if(!Global_videoClip.indexComplete && Global_videoClip.vfile->estimatedFrames > 0)
+			{
+				float indexed = (float)SDL_AtomicGet(&Global_videoClip.vfile->nindexed) / 
+					(float)Global_videoClip.vfile->estimatedFrames;
+				if(indexed > 1.0f) indexed = 1.0f;
+				SDL_Rect indexedRect = Global_videoClip.tlRect;
+				indexedRect.w = (float)indexedRect.w * indexed;
+				indexedRect.h = 4;
+				indexedRect.y = Global_videoClip.tlRect.y + Global_videoClip.tlRect.h - indexedRect.h;
+				setRenderColor(Global_renderer, tcVideoBlue);
+				SDL_RenderFillRect(Global_renderer, &indexedRect);
+			}
 
-		setRenderColor(Global_renderer, tcBlue);
-		SDL_Rect clickr = {mouse.click.x - 5, mouse.click.y - 5, 10 , 10};
-		SDL_RenderFillRect(Global_renderer, &clickr);
+			setRenderColor(Global_renderer, tcRed);
+			SDL_RenderFillRect(Global_renderer, &Global_views.scrubber);
 
-		if(Global_drawClipBoundRect)
-		{
-			// drawClipBoundRect(Global_renderer, Global_videoClip, tcRed, 5); // DEBUG
-		}
+			setRenderColor(Global_renderer, tcGreen);
+			SDL_Rect mouser = {mouse.x - 5, mouse.y - 5, 10, 10};
+			SDL_RenderFillRect(Global_renderer, &mouser);
 
-		if(mouse.down)
-		{
-			SDL_Point p = {mouse.x, mouse.y};
-			if(SDL_PointInRect(&p, &Global_views.background))
+			setRenderColor(Global_renderer, tcBlue);
+			SDL_Rect clickr = {mouse.click.x - 5, mouse.click.y - 5, 10 , 10};
+			SDL_RenderFillRect(Global_renderer, &clickr);
+
+			if(Global_drawClipBoundRect)
 			{
-				Global_videoClip.videoRect.x = Global_origVideoPoint.x + (mouse.x - mouse.click.x);
-				Global_videoClip.videoRect.y = Global_origVideoPoint.y + (mouse.y - mouse.click.y);
+				// drawClipBoundRect(Global_renderer, Global_videoClip, tcRed, 5); // DEBUG
 			}
+
+			SDL_RenderPresent(Global_renderer);
+			finishRedraw(&Global_redraw);
 		}
 
-		SDL_RenderPresent(Global_renderer);
+		// Refill the reverse stepping buffer while the user is looking at the current frame
+		if(Global_paused && !Global_reverse.active && seekEngineIdle(&Global_seekEngine))
+		{
+			prefetchReverseGop(&Global_videoClip, Global_playIndex);
+		}
 	}
 
+	freeReversePlayback(&Global_reverse);
+	freePrefetcher(&Global_prefetcher);
+	freeScrubCache(&Global_scrubCache);
+	freeSeekEngine(&Global_seekEngine);
+	freePlayback(&Global_playback);
 	freeVideoClip(&Global_videoClip);
 	freeVideoFile(&Global_videoFile);
+	freeSoftPresenter(&Global_softPresenter);
+	printRedrawStats(&Global_redraw);
 
+	freeTextRenderer(&hudText);
 	TTF_CloseFont(fontDroidSansMono24);
 	TTF_CloseFont(fontDroidSansMono32);
 
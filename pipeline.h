@@ -0,0 +1,202 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+// Demuxed packets that were not taken by the decoder yet
+#define PIPELINE_QUEUE_DEPTH 8
+
+// NOTE: The decode layer, shaped like libavcodec's send/receive API: sendPacket() hands a packet to
+// the decoder, receiveFrame() takes a decoded frame out, EAGAIN from either one means "call the
+// other one first" and EOF means the decoder has been drained. The libavcodec this is built against
+// (57.33) does not have avcodec_send_packet()/avcodec_receive_frame() yet, so both are emulated on
+// top of avcodec_decode_video2(): a sent packet is decoded right away into a pending frame (the
+// frame-ready state) and the next packet is refused until that frame was received. Once the real
+// API is available only these two functions have to change.
+//
+// Nothing in here drains the decoder unless the demuxer reached the end of the file, so the frames
+// the decoder holds back (B-frame reordering, frame threading) stay in flight across frames, steps
+// and seeks that don't have to go back to a keyframe. Packets are counted by their decode index
+// (nextPacket) so the seek planner knows where the decoder is.
+struct DecodePipeline
+{
+	AVFormatContext *formatCtx   = NULL;
+	AVCodecContext  *codecCtx    = NULL;
+	int              streamIndex = -1;
+	AVPacket         queue[PIPELINE_QUEUE_DEPTH];
+	int              queueHead   = 0;
+	int              queueCount  = 0;
+	AVFrame         *pending     = NULL;
+	bool             frameReady  = false;
+	bool             draining    = false; // The end of the file was sent, only delayed frames are left
+	bool             demuxEof    = false;
+	int              nextPacket  = -1;    // Decode index of the next packet sent, -1 if unknown
+	int              skipUntil   = -1;    // Packets before this decode index skip non-reference frames
+	uint64           packetsSent = 0;
+};
+
+void createDecodePipeline(DecodePipeline *pipe, AVFormatContext *formatCtx, AVCodecContext *codecCtx,
+                          int streamIndex)
+{
+	*pipe = DecodePipeline();
+	pipe->formatCtx = formatCtx;
+	pipe->codecCtx = codecCtx;
+	pipe->streamIndex = streamIndex;
+	pipe->pending = av_frame_alloc();
+	for(int i = 0; i < PIPELINE_QUEUE_DEPTH; ++i)
+	{
+		av_init_packet(&pipe->queue[i]);
+		pipe->queue[i].data = NULL;
+		pipe->queue[i].size = 0;
+	}
+}
+
+internal void clearPacketQueue(DecodePipeline *pipe)
+{
+	for(int i = 0; i < pipe->queueCount; ++i)
+	{
+		av_packet_unref(&pipe->queue[(pipe->queueHead + i) % PIPELINE_QUEUE_DEPTH]);
+	}
+	pipe->queueHead = 0;
+	pipe->queueCount = 0;
+}
+
+void freeDecodePipeline(DecodePipeline *pipe)
+{
+	clearPacketQueue(pipe);
+	av_frame_free(&pipe->pending);
+	*pipe = DecodePipeline();
+}
+
+// Emulates avcodec_send_packet(). A NULL packet starts draining.
+int sendPacket(DecodePipeline *pipe, AVPacket *packet)
+{
+	if(pipe->draining) return AVERROR_EOF;
+	if(pipe->frameReady) return AVERROR(EAGAIN);
+	if(!packet)
+	{
+		pipe->draining = true;
+		return 0;
+	}
+
+	AVCodecContext *codecCtx = pipe->codecCtx;
+	bool skip = pipe->nextPacket >= 0 && pipe->nextPacket < pipe->skipUntil;
+	codecCtx->skip_frame = skip ? AVDISCARD_NONREF : AVDISCARD_DEFAULT;
+
+	int gotFrame = 0;
+	int result = avcodec_decode_video2(codecCtx, pipe->pending, &gotFrame, packet);
+	codecCtx->skip_frame = AVDISCARD_DEFAULT;
+	if(pipe->nextPacket >= 0) pipe->nextPacket++;
+	pipe->packetsSent++;
+	// NOTE: A packet the decoder could not use is dropped, like a real decoder does
+	pipe->frameReady = result >= 0 && gotFrame;
+	return 0;
+}
+
+// Emulates avcodec_receive_frame(). The frame is replaced by the decoded frame.
+int receiveFrame(DecodePipeline *pipe, AVFrame *frame)
+{
+	if(!pipe->frameReady && pipe->draining)
+	{
+		AVPacket packet;
+		av_init_packet(&packet);
+		packet.data = NULL;
+		packet.size = 0;
+		int gotFrame = 0;
+		if(avcodec_decode_video2(pipe->codecCtx, pipe->pending, &gotFrame, &packet) < 0 || !gotFrame)
+		{
+			return AVERROR_EOF;
+		}
+		pipe->frameReady = true;
+	}
+	if(!pipe->frameReady) return AVERROR(EAGAIN);
+
+	av_frame_unref(frame);
+	av_frame_move_ref(frame, pipe->pending);
+	pipe->frameReady = false;
+	return 0;
+}
+
+// Reads the next packet of the stream into the queue, false at the end of the file.
+internal bool demuxPacket(DecodePipeline *pipe)
+{
+	if(pipe->demuxEof || pipe->queueCount == PIPELINE_QUEUE_DEPTH) return false;
+	AVPacket *packet = &pipe->queue[(pipe->queueHead + pipe->queueCount) % PIPELINE_QUEUE_DEPTH];
+	while(av_read_frame(pipe->formatCtx, packet) >= 0)
+	{
+		if(packet->stream_index == pipe->streamIndex)
+		{
+			pipe->queueCount++;
+			return true;
+		}
+		av_packet_unref(packet);
+	}
+	pipe->demuxEof = true;
+	return false;
+}
+
+// Pumps packets through the decoder until the next frame (in display order) comes out. Returns
+// false once the decoder is drained at the end of the file.
+bool decodeNextFrame(DecodePipeline *pipe, AVFrame *frame)
+{
+	for(;;)
+	{
+		int result = receiveFrame(pipe, frame);
+		if(result == 0) return true;
+		if(result == AVERROR_EOF) return false;
+
+		if(pipe->queueCount == 0 && !demuxPacket(pipe))
+		{
+			sendPacket(pipe, NULL);
+			continue;
+		}
+		AVPacket *packet = &pipe->queue[pipe->queueHead];
+		if(sendPacket(pipe, packet) == 0)
+		{
+			av_packet_unref(packet);
+			pipe->queueHead = (pipe->queueHead + 1) % PIPELINE_QUEUE_DEPTH;
+			pipe->queueCount--;
+		}
+	}
+}
+
+// Reads past the next count packets without decoding them. Only for decoders that hold no frames
+// back (intra-only video on a single thread), the packets in flight would be lost otherwise.
+bool skipPackets(DecodePipeline *pipe, int count)
+{
+	for(int i = 0; i < count; ++i)
+	{
+		if(pipe->queueCount == 0 && !demuxPacket(pipe)) return false;
+		av_packet_unref(&pipe->queue[pipe->queueHead]);
+		pipe->queueHead = (pipe->queueHead + 1) % PIPELINE_QUEUE_DEPTH;
+		pipe->queueCount--;
+		if(pipe->nextPacket >= 0) pipe->nextPacket++;
+	}
+	return true;
+}
+
+// Drops everything in flight, for when the demuxer is moved.
+void flushDecodePipeline(DecodePipeline *pipe)
+{
+	avcodec_flush_buffers(pipe->codecCtx);
+	clearPacketQueue(pipe);
+	av_frame_unref(pipe->pending);
+	pipe->frameReady = false;
+	pipe->draining = false;
+	pipe->demuxEof = false;
+	pipe->nextPacket = -1;
+	pipe->skipUntil = -1;
+}
+
+// Moves the demuxer to the keyframe packet with the given decode index and dts. Without an index
+// pass -1 for the packet, the pipeline then does not know where it is.
+bool seekDecodePipeline(DecodePipeline *pipe, int packet, int64 timestamp)
+{
+	flushDecodePipeline(pipe);
+	if(av_seek_frame(pipe->formatCtx, pipe->streamIndex, timestamp, AVSEEK_FLAG_BACKWARD) < 0)
+	{
+		return false;
+	}
+	pipe->nextPacket = packet;
+	return true;
+}
+
+#endif
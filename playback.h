@@ -0,0 +1,435 @@
+#ifndef PLAYBACK_H
+#define PLAYBACK_H
+
+// Number of converted frames the decode thread may run ahead of the screen. Every slot holds a
+// full YUV420P frame, so 4K needs ~12 MB per slot (direct frames hold the decoder's buffer instead).
+// While the video is shown smaller the frames are converted at that size (displayThreadSize()).
+#define PLAYBACK_QUEUE_DEPTH 8
+// Decode threads for intra-only video, each with its own codec context
+#define PLAYBACK_MAX_WORKERS 8
+
+#include "decoder.h"
+
+struct ReadyFrame
+{
+	int           index;
+	SDL_atomic_t  ready;  // Parallel playback only, the slot holds a frame that was not shown yet
+	AVFrame      *frame;  // Direct frames (upload.h) by reference, the planes are not used then
+	uint8        *yPlane;
+	uint8        *uPlane;
+	uint8        *vPlane;
+	int           width;  // Size of the planes, the video's or the display size
+	int           height;
+};
+
+struct Playback;
+
+struct PlaybackWorker
+{
+	Playback     *pb;
+	SDL_Thread   *thread = NULL;
+	Decoder       dec;           // Opened by the worker on its first start, kept until freePlayback()
+	SwsContext   *swsCtx = NULL;
+	SwsContext   *scaleCtx = NULL; // To the display size
+};
+
+// NOTE: Single producer (the decode thread) / single consumer (the render loop) ring buffer.
+// head and tail only ever grow, the producer is the only one writing head and the consumer the
+// only one writing tail, so no locks are needed. SDL_AtomicSet() is a full barrier which makes the
+// slot contents visible before the index that publishes them. The semaphore is only used to put the
+// producer to sleep while the queue is full.
+//
+// Intra-only video (every frame a keyframe) is decoded in parallel instead: the workers claim the
+// frames one after another from a shared counter and each decodes its frame with its own decoder,
+// straight from the frame's packet. Frame n after the playhead always goes into slot n % depth, a
+// worker waits until that slot is free and publishes the frame with the slot's ready flag. The
+// consumer takes the slots in order, so frames that finish early just wait. The clip's decoder is
+// not used at all.
+struct Playback
+{
+	VideoClip    *clip;
+	SDL_Thread   *thread        = NULL;
+	SDL_sem      *space         = NULL;
+	ReadyFrame   *slots         = NULL;
+	int           depth         = 0;
+	SDL_atomic_t  head;
+	SDL_atomic_t  tail;
+	SDL_atomic_t  stop;
+	SDL_atomic_t  endOfFile;
+	int           nextFrame     = 0; // Display index of the next frame the producer decodes
+	SwsContext   *scaleCtx      = NULL; // The decode thread's, to the display size
+	bool          active        = false;
+	// Parallel playback
+	PlaybackWorker workers[PLAYBACK_MAX_WORKERS];
+	int           nworkers      = 0;
+	bool          parallel      = false;
+	int           firstFrame    = 0; // Frame in slot 0 (sequence number 0)
+	SDL_atomic_t  claimed;           // Sequence number of the next frame a worker takes
+	// Stats
+	uint64        framesShown   = 0;
+	uint64        underruns     = 0;
+	int           minFill       = 0;
+};
+
+void createPlayback(Playback *pb, VideoClip *clip, int depth)
+{
+	pb->clip = clip;
+	pb->depth = depth;
+	pb->slots = (ReadyFrame *)malloc(depth * sizeof(ReadyFrame));
+	for(int i = 0; i < depth; ++i)
+	{
+		pb->slots[i].index = -1;
+		SDL_AtomicSet(&pb->slots[i].ready, 0);
+		pb->slots[i].frame = av_frame_alloc();
+		pb->slots[i].yPlane = (uint8 *)malloc(clip->cache.yPlaneSz);
+		pb->slots[i].uPlane = (uint8 *)malloc(clip->cache.uvPlaneSz);
+		pb->slots[i].vPlane = (uint8 *)malloc(clip->cache.uvPlaneSz);
+		pb->slots[i].width = clip->vfile->width;
+		pb->slots[i].height = clip->vfile->height;
+	}
+	pb->space = SDL_CreateSemaphore(0);
+	pb->thread = NULL;
+	pb->active = false;
+	pb->framesShown = 0;
+	pb->underruns = 0;
+	pb->minFill = depth;
+
+	// Leave a core for the main thread
+	int cores = SDL_GetCPUCount();
+	pb->nworkers = (cores - 1 < PLAYBACK_MAX_WORKERS) ? cores - 1 : PLAYBACK_MAX_WORKERS;
+	if(pb->nworkers < 0) pb->nworkers = 0;
+	for(int i = 0; i < pb->nworkers; ++i)
+	{
+		pb->workers[i] = PlaybackWorker();
+		pb->workers[i].pb = pb;
+	}
+	pb->parallel = false;
+}
+
+inline int playbackQueueFill(Playback *pb)
+{
+	return SDL_AtomicGet(&pb->head) - SDL_AtomicGet(&pb->tail);
+}
+
+internal int playbackDecodeThread(void *data)
+{
+	Playback *pb = (Playback *)data;
+	VideoClip *clip = pb->clip;
+
+	while(!SDL_AtomicGet(&pb->stop))
+	{
+		int head = SDL_AtomicGet(&pb->head);
+		if(head - SDL_AtomicGet(&pb->tail) >= pb->depth)
+		{
+			SDL_SemWaitTimeout(pb->space, 10);
+			continue;
+		}
+		// Don't run past what the indexing thread has seen yet
+		if(pb->nextFrame >= indexedFrameCount(clip->vfile))
+		{
+			SDL_Delay(5);
+			continue;
+		}
+
+		if(decodeSingleFrame(clip) <= 0)
+		{
+			SDL_AtomicSet(&pb->endOfFile, 1);
+			break;
+		}
+
+		// Direct frames are uploaded from the decoder's buffer, the main thread lets go of it. The
+		// frame is cached here so the render loop only pops and uploads.
+		// NOTE: While the video is shown smaller the frame is only converted at the display size. A
+		// direct frame is still cached (that is a copy), a full size conversion just for the cache
+		// is not made.
+		ReadyFrame *slot = &pb->slots[head % pb->depth];
+		int index = pb->nextFrame++;
+		int width, height;
+		bool direct = directFrame(clip->vfile, clip->frame);
+		if(direct)
+		{
+			frameCacheInsertStrided(&clip->cache, index, index, clip->frame->data,
+			                        clip->frame->linesize);
+		}
+		if(!displayThreadSize(clip, &width, &height) ||
+		   !scaleFrameTo(&pb->scaleCtx, clip->frame, width, height,
+		                 slot->yPlane, slot->uPlane, slot->vPlane))
+		{
+			width = clip->vfile->width;
+			height = clip->vfile->height;
+			if(direct)
+			{
+				av_frame_ref(slot->frame, clip->frame);
+			}
+			else
+			{
+				convertVideoClipFrameTo(clip, slot->yPlane, slot->uPlane, slot->vPlane);
+				frameCacheInsert(&clip->cache, index, index,
+				                 slot->yPlane, slot->uPlane, slot->vPlane);
+			}
+		}
+		slot->index = index;
+		slot->width = width;
+		slot->height = height;
+		SDL_AtomicSet(&pb->head, head + 1);
+	}
+	return 0;
+}
+
+internal int playbackWorkerThread(void *data)
+{
+	PlaybackWorker *worker = (PlaybackWorker *)data;
+	Playback *pb = worker->pb;
+	VideoClip *clip = pb->clip;
+	VideoFile *vfile = clip->vfile;
+
+	if(!worker->dec.codecCtx)
+	{
+		if(!openDecoder(&worker->dec, vfile)) return 0;
+		worker->swsCtx = sws_getContext(vfile->width, vfile->height, worker->dec.codecCtx->pix_fmt,
+		                                vfile->width, vfile->height, AV_PIX_FMT_YUV420P,
+		                                SWS_BILINEAR, NULL, NULL, NULL);
+	}
+
+	while(!SDL_AtomicGet(&pb->stop))
+	{
+		int sequence = SDL_AtomicAdd(&pb->claimed, 1);
+		int frame = pb->firstFrame + sequence;
+		if(frame >= (int)vfile->nframes)
+		{
+			SDL_AtomicSet(&pb->endOfFile, 1);
+			break;
+		}
+
+		while(sequence - SDL_AtomicGet(&pb->tail) >= pb->depth && !SDL_AtomicGet(&pb->stop))
+		{
+			SDL_SemWaitTimeout(pb->space, 10);
+		}
+		if(SDL_AtomicGet(&pb->stop)) break;
+
+		ReadyFrame *slot = &pb->slots[sequence % pb->depth];
+		AVFrame *decoded = worker->dec.frame;
+		int width = vfile->width;
+		int height = vfile->height;
+		int displayWidth, displayHeight;
+		if(copyRawFrame(clip, frame, slot->yPlane, slot->uPlane, slot->vPlane))
+		{
+			// Uncompressed, nothing to decode (or cache, the mapped file has it)
+		}
+		else if(decodeIntraFrame(&worker->dec, vfile, frame))
+		{
+			// Like playbackDecodeThread(), display sized frames are only cached when direct
+			bool direct = directFrame(vfile, decoded);
+			if(direct)
+			{
+				frameCacheInsertStrided(&clip->cache, frame, frame, decoded->data, decoded->linesize);
+			}
+			if(displayThreadSize(clip, &displayWidth, &displayHeight) &&
+			   scaleFrameTo(&worker->scaleCtx, decoded, displayWidth, displayHeight,
+			                slot->yPlane, slot->uPlane, slot->vPlane))
+			{
+				width = displayWidth;
+				height = displayHeight;
+			}
+			else if(direct)
+			{
+				av_frame_move_ref(slot->frame, decoded);
+			}
+			else
+			{
+				if(ditherFrame(decoded, vfile->width, vfile->height))
+				{
+					ditherFrameTo(&clip->dither, decoded, slot->yPlane, slot->uPlane, slot->vPlane);
+				}
+				else
+				{
+					uint8 *data[4] = { slot->yPlane, slot->uPlane, slot->vPlane, NULL };
+					int linesize[4] = { vfile->width, clip->uvPitch, clip->uvPitch, 0 };
+					sws_scale(worker->swsCtx, (uint8 const * const *)decoded->data,
+					          decoded->linesize, 0, vfile->height, data, linesize);
+				}
+				frameCacheInsert(&clip->cache, frame, frame, slot->yPlane, slot->uPlane, slot->vPlane);
+			}
+		}
+		// NOTE: A frame that could not be decoded still takes its turn (with whatever was in the
+		// slot), the frames after it would never be shown otherwise.
+		slot->index = frame;
+		slot->width = width;
+		slot->height = height;
+		SDL_AtomicSet(&slot->ready, 1);
+	}
+	return 0;
+}
+
+inline bool canPlayInParallel(Playback *pb)
+{
+	return pb->nworkers > 1 && frameIndexReady(pb->clip->vfile) && pb->clip->vfile->intraOnly;
+}
+
+// Starts decoding ahead from the frame after the playhead. The decoder is switched to the playback
+// codec context and moved under the playhead first if it is somewhere else. From here until
+// stopPlayback() the decode thread owns the clip's decoder, frame and scaler.
+void startPlayback(Playback *pb, int playhead)
+{
+	VideoClip *clip = pb->clip;
+	pb->parallel = canPlayInParallel(pb);
+	if(!pb->parallel)
+	{
+		clip->decodeMode = DecodeMode_Playback;
+		useDecodeMode(clip, DecodeMode_Playback);
+		if(clip->decoderFrame != playhead)
+		{
+			seekToAnyFrame(clip, playhead);
+		}
+	}
+
+	SDL_AtomicSet(&pb->head, 0);
+	SDL_AtomicSet(&pb->tail, 0);
+	SDL_AtomicSet(&pb->stop, 0);
+	SDL_AtomicSet(&pb->endOfFile, 0);
+	while(SDL_SemTryWait(pb->space) == 0);
+	pb->nextFrame = playhead + 1;
+	pb->minFill = pb->depth;
+	pb->active = true;
+	if(pb->parallel)
+	{
+		pb->firstFrame = playhead + 1;
+		SDL_AtomicSet(&pb->claimed, 0);
+		for(int i = 0; i < pb->depth; ++i)
+		{
+			SDL_AtomicSet(&pb->slots[i].ready, 0);
+		}
+		for(int i = 0; i < pb->nworkers; ++i)
+		{
+			pb->workers[i].thread = SDL_CreateThread(playbackWorkerThread, "MousePlayWorker",
+			                                         &pb->workers[i]);
+		}
+	}
+	else
+	{
+		pb->thread = SDL_CreateThread(playbackDecodeThread, "MouseDecoder", pb);
+	}
+}
+
+// Stops the decode thread and hands the decoder back to the caller. Frames still in the queue are
+// dropped, the decoder is left on the last frame it decoded (forward steps go on from there with
+// the playback context, the next seek switches to the seek context).
+void stopPlayback(Playback *pb)
+{
+	if(!pb->active) return;
+
+	SDL_AtomicSet(&pb->stop, 1);
+	SDL_SemPost(pb->space);
+	if(pb->parallel)
+	{
+		for(int i = 0; i < pb->nworkers; ++i)
+		{
+			SDL_WaitThread(pb->workers[i].thread, NULL);
+			pb->workers[i].thread = NULL;
+		}
+	}
+	else
+	{
+		SDL_WaitThread(pb->thread, NULL);
+		pb->thread = NULL;
+		pb->clip->decoderFrame = pb->nextFrame - 1;
+		pb->clip->decodeMode = DecodeMode_Seek;
+	}
+	pb->active = false;
+	for(int i = 0; i < pb->depth; ++i)
+	{
+		av_frame_unref(pb->slots[i].frame);
+	}
+	SDL_AtomicSet(&pb->head, 0);
+	SDL_AtomicSet(&pb->tail, 0);
+
+	printf("Playback stopped: %llu frames shown, %llu underruns, queue low water %d/%d\n",
+	       pb->framesShown, pb->underruns, pb->minFill, pb->depth); // DEBUG
+}
+
+// Pops the next decoded frame and uploads it to the clip's texture, the producers cache the frames
+// they decode. Returns the frame's display index, or -1 if the decode thread has not caught up (an
+// underrun).
+int presentNextPlaybackFrame(Playback *pb)
+{
+	int tail = SDL_AtomicGet(&pb->tail);
+	ReadyFrame *slot = &pb->slots[tail % pb->depth];
+	if(pb->parallel)
+	{
+		if(!SDL_AtomicGet(&slot->ready))
+		{
+			if(!SDL_AtomicGet(&pb->endOfFile)) pb->underruns++;
+			return -1;
+		}
+	}
+	else
+	{
+		int fill = SDL_AtomicGet(&pb->head) - tail;
+		if(fill <= 0)
+		{
+			if(!SDL_AtomicGet(&pb->endOfFile)) pb->underruns++;
+			return -1;
+		}
+		if(fill < pb->minFill) pb->minFill = fill;
+	}
+
+	VideoClip *clip = pb->clip;
+	if(slot->frame->buf[0])
+	{
+		uploadDecodedFrame(clip, slot->frame);
+		av_frame_unref(slot->frame);
+	}
+	else
+	{
+		uploadPlanesOfSize(clip, slot->yPlane, slot->uPlane, slot->vPlane,
+		                   slot->width, slot->height);
+	}
+	int index = slot->index;
+
+	SDL_AtomicSet(&slot->ready, 0);
+	SDL_AtomicSet(&pb->tail, tail + 1);
+	SDL_SemPost(pb->space);
+	pb->framesShown++;
+	return index;
+}
+
+// True once the decode thread reached the end of the file and everything it decoded was shown.
+inline bool playbackFinished(Playback *pb)
+{
+	if(!pb->active || !SDL_AtomicGet(&pb->endOfFile)) return false;
+	if(pb->parallel)
+	{
+		return pb->firstFrame + SDL_AtomicGet(&pb->tail) >= (int)pb->clip->vfile->nframes;
+	}
+	return playbackQueueFill(pb) <= 0;
+}
+
+void freePlayback(Playback *pb)
+{
+	stopPlayback(pb);
+	for(int i = 0; i < pb->depth; ++i)
+	{
+		av_frame_free(&pb->slots[i].frame);
+		free(pb->slots[i].yPlane);
+		free(pb->slots[i].uPlane);
+		free(pb->slots[i].vPlane);
+	}
+	free(pb->slots);
+	pb->slots = NULL;
+	sws_freeContext(pb->scaleCtx);
+	pb->scaleCtx = NULL;
+	for(int i = 0; i < pb->nworkers; ++i)
+	{
+		PlaybackWorker *worker = &pb->workers[i];
+		if(worker->dec.codecCtx) closeDecoder(&worker->dec);
+		sws_freeContext(worker->swsCtx);
+		sws_freeContext(worker->scaleCtx);
+		*worker = PlaybackWorker();
+	}
+	pb->nworkers = 0;
+	pb->depth = 0;
+	if(pb->space) SDL_DestroySemaphore(pb->space);
+	pb->space = NULL;
+}
+
+#endif
@@ -0,0 +1,312 @@
+#ifndef PREFETCH_H
+#define PREFETCH_H
+
+#include "decoder.h"
+
+// CPU budget for speculative decoding: the number of worker threads (each has its own decoder) and
+// how many GOPs they may run ahead of the playhead. The GOPs ahead are further limited to what fits
+// in half of the frame cache so prefetching never evicts the frames around the playhead.
+// The number of threads can be set with --prefetch-threads=N.
+#define PREFETCH_DEFAULT_THREADS 2
+#define PREFETCH_MAX_THREADS     8
+#define PREFETCH_MAX_GOPS        4
+// Playhead movements older than this don't count towards the direction and velocity
+#define PREFETCH_HISTORY         16
+#define PREFETCH_WINDOW_MS       500
+// Frames the playhead is expected to cover in this time are prefetched
+#define PREFETCH_LOOKAHEAD_MS    1000
+
+struct Prefetcher;
+
+struct PrefetchWorker
+{
+	Prefetcher   *pf;
+	SDL_Thread   *thread = NULL;
+	SwsContext   *swsCtx = NULL;
+	uint8        *yPlane = NULL;
+	uint8        *uPlane = NULL;
+	uint8        *vPlane = NULL;
+	int           gop    = -1;   // GOP being decoded, guarded by the prefetcher's lock
+};
+
+// NOTE: Guesses where the playhead goes next from how Global_playIndex moved recently (stepping
+// with the arrow keys, dragging on the timeline) and decodes the GOPs in that direction into the
+// clip's frame cache on low priority worker threads, before anyone asks for them. Every worker has
+// its own Decoder so the clip's decoder is never touched and the main thread, the playback thread
+// and the seek thread can keep using it.
+//
+// The job queue is rebuilt by the main thread every time the playhead moves. When the direction
+// of movement changes all queued and running work is cancelled (the generation is bumped) because
+// it is on the wrong side of the playhead.
+struct Prefetcher
+{
+	VideoClip      *clip;
+	PrefetchWorker  workers[PREFETCH_MAX_THREADS];
+	int             nworkers   = 0;
+	int             maxGops    = PREFETCH_MAX_GOPS;
+	// Job queue, guarded by lock
+	SDL_mutex      *lock       = NULL;
+	SDL_cond       *wake       = NULL;
+	int             jobs[PREFETCH_MAX_GOPS];
+	int             njobs      = 0;
+	SDL_atomic_t    generation;
+	SDL_atomic_t    playhead;
+	SDL_atomic_t    quit;
+	// Predictor, only touched by the main thread
+	int             history[PREFETCH_HISTORY];
+	uint32          historyTicks[PREFETCH_HISTORY];
+	int             nhistory   = 0;
+	int             direction  = 0;  // -1 backwards, 1 forwards, 0 not known yet
+	int             lastPlayhead = -1;
+	// Stats
+	SDL_atomic_t    gopsDecoded;
+	SDL_atomic_t    gopsCancelled;
+	SDL_atomic_t    framesDecoded;
+};
+
+internal void storePrefetchedFrame(void *userdata, int index, AVFrame *frame)
+{
+	PrefetchWorker *worker = (PrefetchWorker *)userdata;
+	VideoClip *clip = worker->pf->clip;
+	VideoFile *vfile = clip->vfile;
+	int playhead = SDL_AtomicGet(&worker->pf->playhead);
+	if(directFrame(vfile, frame))
+	{
+		frameCacheInsertStrided(&clip->cache, index, playhead, frame->data, frame->linesize);
+	}
+	else
+	{
+		if(ditherFrame(frame, vfile->width, vfile->height))
+		{
+			ditherFrameTo(&clip->dither, frame, worker->yPlane, worker->uPlane, worker->vPlane);
+		}
+		else
+		{
+			uint8 *data[4] = { worker->yPlane, worker->uPlane, worker->vPlane, NULL };
+			int linesize[4] = { vfile->width, clip->uvPitch, clip->uvPitch, 0 };
+			sws_scale(worker->swsCtx, (uint8 const * const *)frame->data, frame->linesize,
+			          0, frame->height, data, linesize);
+		}
+		frameCacheInsert(&clip->cache, index, playhead, worker->yPlane, worker->uPlane,
+		                 worker->vPlane);
+	}
+	SDL_AtomicIncRef(&worker->pf->framesDecoded);
+}
+
+internal int prefetchThread(void *data)
+{
+	PrefetchWorker *worker = (PrefetchWorker *)data;
+	Prefetcher *pf = worker->pf;
+	VideoFile *vfile = pf->clip->vfile;
+
+	SDL_SetThreadPriority(SDL_THREAD_PRIORITY_LOW);
+
+	Decoder dec;
+	if(!openDecoder(&dec, vfile)) return 0;
+	worker->swsCtx = sws_getContext(vfile->width, vfile->height, dec.codecCtx->pix_fmt,
+	                                vfile->width, vfile->height, AV_PIX_FMT_YUV420P,
+	                                SWS_BILINEAR, NULL, NULL, NULL);
+
+	SDL_LockMutex(pf->lock);
+	while(!SDL_AtomicGet(&pf->quit))
+	{
+		if(pf->njobs == 0)
+		{
+			SDL_CondWaitTimeout(pf->wake, pf->lock, 100);
+			continue;
+		}
+
+		// Jobs are queued nearest first
+		int gop = pf->jobs[0];
+		--pf->njobs;
+		memmove(pf->jobs, pf->jobs + 1, pf->njobs * sizeof(int));
+		worker->gop = gop;
+
+		CancelToken cancel;
+		cancel.generation = &pf->generation;
+		cancel.value = SDL_AtomicGet(&pf->generation);
+		SDL_UnlockMutex(pf->lock);
+
+		if(decodeGop(&dec, vfile, gop, cancel, storePrefetchedFrame, worker) && !cancelled(cancel))
+		{
+			SDL_AtomicIncRef(&pf->gopsDecoded);
+		}
+		else
+		{
+			SDL_AtomicIncRef(&pf->gopsCancelled);
+		}
+
+		SDL_LockMutex(pf->lock);
+		worker->gop = -1;
+	}
+	SDL_UnlockMutex(pf->lock);
+
+	sws_freeContext(worker->swsCtx);
+	worker->swsCtx = NULL;
+	closeDecoder(&dec);
+	return 0;
+}
+
+void createPrefetcher(Prefetcher *pf, VideoClip *clip, int nthreads, int maxGops)
+{
+	pf->clip = clip;
+	// Leave at least one core for the main thread and the clip's own decoder
+	int cores = SDL_GetCPUCount();
+	if(nthreads > cores - 1) nthreads = cores - 1;
+	if(nthreads > PREFETCH_MAX_THREADS) nthreads = PREFETCH_MAX_THREADS;
+	if(nthreads < 0) nthreads = 0;
+	if(maxGops > PREFETCH_MAX_GOPS) maxGops = PREFETCH_MAX_GOPS;
+	if(maxGops < 1) maxGops = 1;
+	pf->nworkers = nthreads;
+	pf->maxGops = maxGops;
+	pf->njobs = 0;
+	pf->nhistory = 0;
+	pf->direction = 0;
+	pf->lastPlayhead = -1;
+	pf->lock = SDL_CreateMutex();
+	pf->wake = SDL_CreateCond();
+	SDL_AtomicSet(&pf->generation, 0);
+	SDL_AtomicSet(&pf->playhead, 0);
+	SDL_AtomicSet(&pf->quit, 0);
+	SDL_AtomicSet(&pf->gopsDecoded, 0);
+	SDL_AtomicSet(&pf->gopsCancelled, 0);
+	SDL_AtomicSet(&pf->framesDecoded, 0);
+
+	for(int i = 0; i < pf->nworkers; ++i)
+	{
+		PrefetchWorker *worker = &pf->workers[i];
+		*worker = PrefetchWorker();
+		worker->pf = pf;
+		worker->yPlane = (uint8 *)malloc(clip->cache.yPlaneSz);
+		worker->uPlane = (uint8 *)malloc(clip->cache.uvPlaneSz);
+		worker->vPlane = (uint8 *)malloc(clip->cache.uvPlaneSz);
+		worker->thread = SDL_CreateThread(prefetchThread, "MousePrefetch", worker);
+	}
+}
+
+// Drops the queued GOPs and cancels the ones being decoded.
+void cancelPrefetch(Prefetcher *pf)
+{
+	if(!pf->lock) return;
+	SDL_LockMutex(pf->lock);
+	SDL_AtomicIncRef(&pf->generation);
+	pf->njobs = 0;
+	SDL_UnlockMutex(pf->lock);
+}
+
+// A GOP is treated as cached when its first and last frames are.
+internal bool gopCached(VideoClip *clip, int gop)
+{
+	VideoFile *vfile = clip->vfile;
+	int start, end;
+	gopFrameRange(vfile, gop, &start, &end);
+	return frameCacheContains(&clip->cache, start) && frameCacheContains(&clip->cache, end - 1);
+}
+
+// Feeds the predictor with the playhead, call it once per main loop iteration. While playing
+// (either way) nothing is prefetched, the playback threads are already decoding ahead.
+void updatePrefetch(Prefetcher *pf, int playhead, bool playing)
+{
+	VideoClip *clip = pf->clip;
+	if(!pf->nworkers || !clip->indexComplete) return;
+	if(playhead == pf->lastPlayhead) return;
+
+	uint32 now = SDL_GetTicks();
+	int slot = pf->nhistory % PREFETCH_HISTORY;
+	pf->history[slot] = playhead;
+	pf->historyTicks[slot] = now;
+	pf->nhistory++;
+	pf->lastPlayhead = playhead;
+	SDL_AtomicSet(&pf->playhead, playhead);
+
+	// Direction and speed over the recent movements. A single jump after a pause still gives a
+	// direction, its speed is just taken as one GOP.
+	int oldest = pf->nhistory - 1;
+	int count = (pf->nhistory < PREFETCH_HISTORY) ? pf->nhistory : PREFETCH_HISTORY;
+	for(int i = 1; i < count; ++i)
+	{
+		int s = (pf->nhistory - 1 - i) % PREFETCH_HISTORY;
+		if(now - pf->historyTicks[s] > PREFETCH_WINDOW_MS) break;
+		oldest = pf->nhistory - 1 - i;
+	}
+	int oldestSlot = oldest % PREFETCH_HISTORY;
+	int moved = playhead - pf->history[oldestSlot];
+	if(oldest == pf->nhistory - 1 && count > 1)
+	{
+		moved = playhead - pf->history[(pf->nhistory - 2) % PREFETCH_HISTORY];
+	}
+	if(moved == 0) return;
+
+	int direction = (moved > 0) ? 1 : -1;
+	if(direction != pf->direction)
+	{
+		cancelPrefetch(pf);
+		pf->direction = direction;
+	}
+	if(playing) return;
+
+	VideoFile *vfile = clip->vfile;
+	int gopLength = vfile->maxGopLength > 0 ? vfile->maxGopLength : 1;
+	uint32 elapsed = now - pf->historyTicks[oldestSlot];
+	int lookahead = 1;
+	if(elapsed > 0)
+	{
+		float framesPerMs = (float)(moved * direction) / (float)elapsed;
+		lookahead = 1 + (int)(framesPerMs * PREFETCH_LOOKAHEAD_MS) / gopLength;
+	}
+	int cacheGops = (int)clip->cache.nslots / (2 * gopLength);
+	if(lookahead > cacheGops) lookahead = cacheGops;
+	if(lookahead > pf->maxGops) lookahead = pf->maxGops;
+	if(lookahead < 1) return;
+
+	int current = gopForFrame(vfile, playhead);
+	SDL_LockMutex(pf->lock);
+	pf->njobs = 0;
+	for(int i = 1; i <= lookahead; ++i)
+	{
+		int gop = current + i * direction;
+		if(gop < 0 || gop >= (int)vfile->nkeyframes) break;
+
+		bool running = false;
+		for(int w = 0; w < pf->nworkers; ++w)
+		{
+			if(pf->workers[w].gop == gop) running = true;
+		}
+		if(running || gopCached(clip, gop)) continue;
+		pf->jobs[pf->njobs++] = gop;
+	}
+	if(pf->njobs) SDL_CondBroadcast(pf->wake);
+	SDL_UnlockMutex(pf->lock);
+}
+
+void freePrefetcher(Prefetcher *pf)
+{
+	if(!pf->lock) return;
+	cancelPrefetch(pf);
+	SDL_AtomicSet(&pf->quit, 1);
+	SDL_LockMutex(pf->lock);
+	SDL_CondBroadcast(pf->wake);
+	SDL_UnlockMutex(pf->lock);
+	for(int i = 0; i < pf->nworkers; ++i)
+	{
+		PrefetchWorker *worker = &pf->workers[i];
+		SDL_WaitThread(worker->thread, NULL);
+		free(worker->yPlane);
+		free(worker->uPlane);
+		free(worker->vPlane);
+		*worker = PrefetchWorker();
+	}
+	if(pf->nworkers)
+	{
+		printf("Prefetch: %d GOPs (%d frames) decoded ahead, %d cancelled\n",
+		       SDL_AtomicGet(&pf->gopsDecoded), SDL_AtomicGet(&pf->framesDecoded),
+		       SDL_AtomicGet(&pf->gopsCancelled)); // DEBUG
+	}
+	pf->nworkers = 0;
+	SDL_DestroyCond(pf->wake);
+	SDL_DestroyMutex(pf->lock);
+	pf->wake = NULL;
+	pf->lock = NULL;
+}
+
+#endif
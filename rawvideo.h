@@ -0,0 +1,87 @@
+#ifndef RAWVIDEO_H
+#define RAWVIDEO_H
+
+// NOTE: Zero-copy path for uncompressed video. For rawvideo streams the packet payload already is
+// the picture, so the whole video file is memory mapped and a frame is taken straight from the
+// mapped pages at its packet's byte offset (from the index), without the demuxer, the decoder or
+// sws_scale. Only planar 4:2:0 with tightly packed planes matches the clip's YV12 texture and
+// planes, every other raw format (and any packet that doesn't have the expected size) is decoded
+// as usual.
+//
+// The mapping is opened once the index is done (updateVideoClipIndex()), the mapped frames are
+// read only, so any thread may use them after that.
+
+inline uint64 rawFrameSize(VideoFile *vfile)
+{
+	return (uint64)vfile->width * vfile->height * 3 / 2;
+}
+
+void openRawVideo(VideoFile *vfile)
+{
+	vfile->rawDirect = false;
+	AVCodecContext *params = vfile->stream->codec;
+	if(params->codec_id != AV_CODEC_ID_RAWVIDEO) return;
+	if(params->pix_fmt != AV_PIX_FMT_YUV420P && params->pix_fmt != AV_PIX_FMT_YUVJ420P) return;
+	if((vfile->width & 1) || (vfile->height & 1)) return;
+	if(!vfile->index.pos || !mapFile(&vfile->rawFile, vfile->formatCtx->filename)) return;
+
+	// YV12 stores V before U, the rawvideo decoder swaps them back the same way
+	vfile->rawSwapChroma = params->codec_tag == MKTAG('Y', 'V', '1', '2');
+	vfile->rawDirect = true;
+	printf("Raw video: frames are read straight from the mapped file.\n\n");
+}
+
+void closeRawVideo(VideoFile *vfile)
+{
+	if(vfile->rawFile.data) unmapFile(&vfile->rawFile);
+	vfile->rawDirect = false;
+	vfile->rawSwapChroma = false;
+}
+
+// The frame's planes in the mapped file. False if the frame has to be decoded.
+internal bool rawFramePlanes(VideoFile *vfile, int frame, const uint8 **y, const uint8 **u,
+                             const uint8 **v)
+{
+	if(!vfile->rawDirect) return false;
+	int packet = vfile->index.displayToDecode[frame];
+	int64 pos = vfile->index.pos[packet];
+	uint64 size = rawFrameSize(vfile);
+	if(pos < 0 || (uint64)vfile->index.size[packet] != size || (uint64)pos + size > vfile->rawFile.size)
+	{
+		return false;
+	}
+
+	uint64 ySz = (uint64)vfile->width * vfile->height;
+	*y = vfile->rawFile.data + pos;
+	*u = *y + ySz;
+	*v = *u + (ySz / 4);
+	if(vfile->rawSwapChroma)
+	{
+		const uint8 *swap = *u;
+		*u = *v;
+		*v = swap;
+	}
+	return true;
+}
+
+// Uploads the frame to the texture straight from the mapped pages, main thread only.
+bool uploadRawFrame(VideoClip *clip, int frame)
+{
+	const uint8 *y, *u, *v;
+	if(!rawFramePlanes(clip->vfile, frame, &y, &u, &v)) return false;
+	uploadPlanes(clip, y, u, v);
+	return true;
+}
+
+// Copies the frame into planes laid out like the clip's, for threads that hand frames over.
+bool copyRawFrame(VideoClip *clip, int frame, uint8 *yPlane, uint8 *uPlane, uint8 *vPlane)
+{
+	const uint8 *y, *u, *v;
+	if(!rawFramePlanes(clip->vfile, frame, &y, &u, &v)) return false;
+	memcpy(yPlane, y, clip->cache.yPlaneSz);
+	memcpy(uPlane, u, clip->cache.uvPlaneSz);
+	memcpy(vPlane, v, clip->cache.uvPlaneSz);
+	return true;
+}
+
+#endif
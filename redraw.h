@@ -0,0 +1,162 @@
+#ifndef REDRAW_H
+#define REDRAW_H
+
+// Longest wait for an event when nothing is going on, and the wait while a thread has a result for
+// the main thread to pick up (a seek, the reverse GOP to refill) or the index bar is growing
+#define REDRAW_IDLE_MS  250
+#define REDRAW_BUSY_MS  10
+#define REDRAW_INDEX_MS 50
+
+// SDL 2.0.4 waits for events in steps of 10 ms, a wait that is not a whole number of steps overshoots
+#define REDRAW_WAIT_STEP_MS 10
+
+// NOTE: Event driven redraw. The main loop blocks in SDL_WaitEventTimeout() for as long as nothing
+// on screen can change (redrawWaitMs()), and after handling events and picking up frames it only
+// draws when something that is drawn changed since the last frame that was drawn. Instead of every
+// place that changes state marking what it changed, the state the window is drawn from is kept
+// here and compared once per loop (updateRedrawState()), things only SDL knows about (the window
+// was exposed) are marked with markDirty().
+//
+// The regions say why a redraw is needed. The whole window is still drawn for any of them: after
+// SDL_RenderPresent() the back buffer is undefined on most renderers, so nothing can be kept from
+// the last frame. Frames that change nothing are skipped entirely, which while paused is nearly all
+// of them, so the main thread sleeps and the decode and prefetch threads get the core.
+
+enum DirtyRegion
+{
+	DirtyRegion_Video    = 1 << 0, // The frame, zoom and pan
+	DirtyRegion_Scrubber = 1 << 1, // Timeline, scrubber and index progress
+	DirtyRegion_Text     = 1 << 2, // Filename, playhead number and quality tier
+	DirtyRegion_Overlay  = 1 << 3, // Mouse and click markers
+	DirtyRegion_All      = 0xF
+};
+
+// What the last drawn frame was drawn from
+struct RedrawState
+{
+	uint32        dirty        = DirtyRegion_All;
+	int           windowWidth  = 0;
+	int           windowHeight = 0;
+	SDL_Rect      videoRect    = {};
+	SDL_Rect      view         = {};
+	SDL_Rect      timeline     = {};
+	SDL_Rect      scrubber     = {};
+	SDL_Texture  *videoTexture = NULL;
+	uint64        uploads      = 0; // Frames uploaded to the clip, a new frame in the same texture
+	DecodeQuality quality      = DecodeQuality_Full;
+	int           playIndex    = -1;
+	int           indexed      = -1;
+	const char   *filename     = NULL;
+	SDL_Point     mouse        = {};
+	SDL_Point     click        = {};
+	uint32        loops        = 0;
+	uint32        redraws      = 0;
+};
+
+inline void markDirty(RedrawState *rs, uint32 regions)
+{
+	rs->dirty |= regions;
+}
+
+inline uint64 clipUploads(VideoClip *clip)
+{
+	uint64 uploads = 0;
+	for(int path = 0; path < UploadPath_Count; ++path) uploads += clip->uploadStats.frames[path];
+	return uploads;
+}
+
+inline bool sameRect(SDL_Rect *a, SDL_Rect *b)
+{
+	return a->x == b->x && a->y == b->y && a->w == b->w && a->h == b->h;
+}
+
+inline bool samePoint(SDL_Point *a, SDL_Point *b)
+{
+	return a->x == b->x && a->y == b->y;
+}
+
+// Compares what the window would be drawn from now with the last drawn frame. Returns the regions
+// that changed (including ones marked since), 0 if drawing would put the same picture on screen.
+// videoTexture is the texture the video is drawn from (the scrub image or the clip's).
+uint32 updateRedrawState(RedrawState *rs, SDL_Window *window, VideoClip *clip, ViewRects *views,
+                         SDL_Texture *videoTexture, int playIndex, SDL_Point mouse, SDL_Point click)
+{
+	++rs->loops;
+	int windowWidth, windowHeight;
+	SDL_GetWindowSize(window, &windowWidth, &windowHeight);
+	if(windowWidth != rs->windowWidth || windowHeight != rs->windowHeight ||
+	   !sameRect(&views->background, &rs->view))
+	{
+		rs->windowWidth = windowWidth;
+		rs->windowHeight = windowHeight;
+		rs->view = views->background;
+		rs->dirty |= DirtyRegion_All;
+	}
+
+	uint64 uploads = clipUploads(clip);
+	if(!sameRect(&clip->videoRect, &rs->videoRect) || videoTexture != rs->videoTexture ||
+	   uploads != rs->uploads)
+	{
+		rs->videoRect = clip->videoRect;
+		rs->videoTexture = videoTexture;
+		rs->uploads = uploads;
+		rs->dirty |= DirtyRegion_Video;
+	}
+
+	int indexed = clip->indexComplete ? -1 : SDL_AtomicGet(&clip->vfile->nindexed);
+	if(!sameRect(&clip->tlRect, &rs->timeline) || !sameRect(&views->scrubber, &rs->scrubber) ||
+	   indexed != rs->indexed)
+	{
+		rs->timeline = clip->tlRect;
+		rs->scrubber = views->scrubber;
+		rs->indexed = indexed;
+		rs->dirty |= DirtyRegion_Scrubber;
+	}
+
+	if(playIndex != rs->playIndex || clip->shownQuality != rs->quality ||
+	   clip->filename != rs->filename)
+	{
+		rs->playIndex = playIndex;
+		rs->quality = clip->shownQuality;
+		rs->filename = clip->filename;
+		rs->dirty |= DirtyRegion_Text;
+	}
+
+	if(!samePoint(&mouse, &rs->mouse) || !samePoint(&click, &rs->click))
+	{
+		rs->mouse = mouse;
+		rs->click = click;
+		rs->dirty |= DirtyRegion_Overlay;
+	}
+	return rs->dirty;
+}
+
+// Call once the frame is presented
+inline void finishRedraw(RedrawState *rs)
+{
+	rs->dirty = 0;
+	++rs->redraws;
+}
+
+// How long the main loop may block waiting for events. msUntilFrame is how long until the next
+// playback frame is due (negative while not playing), busy is true while a thread has a result the
+// main thread polls for.
+int redrawWaitMs(float msUntilFrame, bool busy, bool indexing)
+{
+	int wait = REDRAW_IDLE_MS;
+	if(indexing) wait = REDRAW_INDEX_MS;
+	if(busy) wait = REDRAW_BUSY_MS;
+	if(msUntilFrame >= 0.0f && (int)msUntilFrame < wait)
+	{
+		// Rounded down so the frame isn't late, close to it the loop only polls
+		wait = ((int)msUntilFrame / REDRAW_WAIT_STEP_MS) * REDRAW_WAIT_STEP_MS;
+	}
+	return wait;
+}
+
+void printRedrawStats(RedrawState *rs)
+{
+	printf("Redraws: %u of %u loops\n", rs->redraws, rs->loops); // DEBUG
+}
+
+#endif
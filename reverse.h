@@ -0,0 +1,389 @@
+#ifndef REVERSE_H
+#define REVERSE_H
+
+#include "decoder.h"
+
+// Reverse playback decodes whole GOPs, newest first, on as many threads as there are spare cores.
+// Each GOP buffer holds every frame of one GOP, the number of buffers is bounded by
+// REVERSE_MEGABYTES (long 4K GOPs get fewer buffers and so fewer threads).
+#define REVERSE_MAX_THREADS 16
+#define REVERSE_MAX_SPEED   8
+#define REVERSE_MEGABYTES   1536
+
+enum ReverseGopState
+{
+	ReverseGop_Free,
+	ReverseGop_Decoding,
+	ReverseGop_Ready,
+	ReverseGop_Failed,  // Could not be decoded, the presenter skips its frames
+};
+
+struct ReverseGop
+{
+	int    gop    = -1;
+	int    state  = ReverseGop_Free;
+	int    start  = 0;    // Display index of the first frame
+	int    count  = 0;
+	uint8 *frames = NULL; // count YUV420P frames back to back
+};
+
+struct ReversePlayback;
+
+struct ReverseWorker
+{
+	ReversePlayback *rp;
+	SDL_Thread      *thread = NULL;
+	SwsContext      *swsCtx = NULL;
+	ReverseGop      *buffer = NULL; // Buffer being decoded into
+};
+
+// NOTE: Shuttling backwards with a single decoder means decoding a GOP from its keyframe for every
+// frame shown (or at least every GOP), which can't keep up in real time on long GOP footage. Here
+// every worker has its own Decoder (and so its own AVCodecContext) and decodes a different earlier
+// GOP at the same time. The main thread shows the frames of the newest finished GOP from its last
+// frame down to its first and then hands the buffer back to the workers, who by then are already
+// decoding the GOPs before it.
+//
+// Workers and buffers are created the first time reverse playback starts and kept until the clip
+// is freed. Stopping bumps the generation, which cancels the GOPs being decoded. None of this uses
+// the clip's decoder, only the clip's texture (main thread) is written.
+struct ReversePlayback
+{
+	VideoClip     *clip;
+	ReverseWorker  workers[REVERSE_MAX_THREADS];
+	int            nworkers    = 0;
+	ReverseGop    *buffers     = NULL;
+	int            nbuffers    = 0;
+	int            frameSz     = 0;
+	// Guarded by lock
+	SDL_mutex     *lock        = NULL;
+	SDL_cond      *wake        = NULL;
+	int            nextGop     = -1; // Next GOP to hand to a worker, -1 when there is none
+	SDL_atomic_t   generation;
+	SDL_atomic_t   quit;
+	// Main thread only
+	bool           active      = false;
+	int            speed       = 1;  // Frames stepped back per frame period
+	int            nextFrame   = -1;
+	// Stats
+	uint64         framesShown = 0;
+	uint64         underruns   = 0;
+	SDL_atomic_t   gopsDecoded;
+};
+
+internal void storeReverseFrame(void *userdata, int index, AVFrame *frame)
+{
+	ReverseWorker *worker = (ReverseWorker *)userdata;
+	ReverseGop *buffer = worker->buffer;
+	VideoClip *clip = worker->rp->clip;
+	if(index < buffer->start || index >= buffer->start + buffer->count) return;
+
+	VideoFile *vfile = clip->vfile;
+	uint8 *y = buffer->frames + ((uint64)(index - buffer->start) * worker->rp->frameSz);
+	uint8 *u = y + clip->cache.yPlaneSz;
+	uint8 *v = u + clip->cache.uvPlaneSz;
+	if(directFrame(vfile, frame))
+	{
+		int width = vfile->width;
+		int uvWidth = clip->uvPitch;
+		int height = vfile->height;
+		av_image_copy_plane(y, width, frame->data[0], frame->linesize[0], width, height);
+		av_image_copy_plane(u, uvWidth, frame->data[1], frame->linesize[1], uvWidth, height / 2);
+		av_image_copy_plane(v, uvWidth, frame->data[2], frame->linesize[2], uvWidth, height / 2);
+	}
+	else if(ditherFrame(frame, vfile->width, vfile->height))
+	{
+		ditherFrameTo(&clip->dither, frame, y, u, v);
+	}
+	else
+	{
+		uint8 *data[4] = { y, u, v, NULL };
+		int linesize[4] = { vfile->width, clip->uvPitch, clip->uvPitch, 0 };
+		sws_scale(worker->swsCtx, (uint8 const * const *)frame->data, frame->linesize,
+		          0, frame->height, data, linesize);
+	}
+}
+
+internal int reverseDecodeThread(void *data)
+{
+	ReverseWorker *worker = (ReverseWorker *)data;
+	ReversePlayback *rp = worker->rp;
+	VideoFile *vfile = rp->clip->vfile;
+
+	Decoder dec;
+	if(!openDecoder(&dec, vfile)) return 0;
+	worker->swsCtx = sws_getContext(vfile->width, vfile->height, dec.codecCtx->pix_fmt,
+	                                vfile->width, vfile->height, AV_PIX_FMT_YUV420P,
+	                                SWS_BILINEAR, NULL, NULL, NULL);
+
+	SDL_LockMutex(rp->lock);
+	while(!SDL_AtomicGet(&rp->quit))
+	{
+		ReverseGop *buffer = NULL;
+		if(rp->nextGop >= 0)
+		{
+			for(int i = 0; i < rp->nbuffers && !buffer; ++i)
+			{
+				if(rp->buffers[i].state == ReverseGop_Free) buffer = &rp->buffers[i];
+			}
+		}
+		if(!buffer)
+		{
+			SDL_CondWaitTimeout(rp->wake, rp->lock, 100);
+			continue;
+		}
+
+		int gop = rp->nextGop--;
+		buffer->gop = gop;
+		buffer->state = ReverseGop_Decoding;
+		int end;
+		gopFrameRange(vfile, gop, &buffer->start, &end);
+		buffer->count = end - buffer->start;
+		// The buffers hold maxGopLength frames, never store more than that
+		if(buffer->count > vfile->maxGopLength) buffer->count = vfile->maxGopLength;
+		worker->buffer = buffer;
+
+		CancelToken cancel;
+		cancel.generation = &rp->generation;
+		cancel.value = SDL_AtomicGet(&rp->generation);
+		SDL_UnlockMutex(rp->lock);
+
+		bool done = decodeGop(&dec, vfile, gop, cancel, storeReverseFrame, worker);
+
+		SDL_LockMutex(rp->lock);
+		worker->buffer = NULL;
+		if(cancelled(cancel))
+		{
+			buffer->state = ReverseGop_Free;
+			buffer->gop = -1;
+		}
+		else if(done)
+		{
+			buffer->state = ReverseGop_Ready;
+			SDL_AtomicIncRef(&rp->gopsDecoded);
+		}
+		else
+		{
+			// NOTE: The GOP is never handed out again, so the presenter has to hear about it or it
+			// would wait for it forever
+			printf("Reverse playback could not decode GOP %d\n", gop); // DEBUG
+			buffer->state = ReverseGop_Failed;
+		}
+	}
+	SDL_UnlockMutex(rp->lock);
+
+	sws_freeContext(worker->swsCtx);
+	worker->swsCtx = NULL;
+	closeDecoder(&dec);
+	return 0;
+}
+
+void createReversePlayback(ReversePlayback *rp, VideoClip *clip)
+{
+	rp->clip = clip;
+	rp->nworkers = 0;
+	rp->buffers = NULL;
+	rp->nbuffers = 0;
+	rp->frameSz = clip->cache.yPlaneSz + (2 * clip->cache.uvPlaneSz);
+	rp->nextGop = -1;
+	rp->active = false;
+	rp->speed = 1;
+	rp->nextFrame = -1;
+	rp->framesShown = 0;
+	rp->underruns = 0;
+	rp->lock = SDL_CreateMutex();
+	rp->wake = SDL_CreateCond();
+	SDL_AtomicSet(&rp->generation, 0);
+	SDL_AtomicSet(&rp->quit, 0);
+	SDL_AtomicSet(&rp->gopsDecoded, 0);
+}
+
+// Sizes the buffers for the longest GOP and starts one worker per spare core, but never more
+// workers than there are buffers to decode into while one is being shown.
+internal bool createReverseWorkers(ReversePlayback *rp)
+{
+	VideoFile *vfile = rp->clip->vfile;
+	if(vfile->maxGopLength <= 0) return false;
+
+	uint64 gopSz = (uint64)vfile->maxGopLength * rp->frameSz;
+	int nbuffers = (int)(((uint64)REVERSE_MEGABYTES * 1024 * 1024) / gopSz);
+	int cores = SDL_GetCPUCount();
+	int nworkers = cores - 1;
+	if(nworkers > REVERSE_MAX_THREADS) nworkers = REVERSE_MAX_THREADS;
+	if(nworkers < 1) nworkers = 1;
+	if(nbuffers > nworkers + 1) nbuffers = nworkers + 1;
+	if(nbuffers < 2) nbuffers = 2;
+	if(nworkers > nbuffers - 1) nworkers = nbuffers - 1;
+
+	rp->buffers = (ReverseGop *)malloc(nbuffers * sizeof(ReverseGop));
+	for(int i = 0; i < nbuffers; ++i)
+	{
+		rp->buffers[i] = ReverseGop();
+		rp->buffers[i].frames = (uint8 *)malloc(gopSz);
+		if(!rp->buffers[i].frames)
+		{
+			printf("Could not allocate reverse playback buffers.\n");
+			for(int j = 0; j < i; ++j) free(rp->buffers[j].frames);
+			free(rp->buffers);
+			rp->buffers = NULL;
+			return false;
+		}
+	}
+	rp->nbuffers = nbuffers;
+
+	rp->nworkers = nworkers;
+	for(int i = 0; i < nworkers; ++i)
+	{
+		ReverseWorker *worker = &rp->workers[i];
+		*worker = ReverseWorker();
+		worker->rp = rp;
+		worker->thread = SDL_CreateThread(reverseDecodeThread, "MouseReverse", worker);
+	}
+	printf("Reverse playback: %d decoders, %d GOP buffers of %d frames\n",
+	       nworkers, nbuffers, vfile->maxGopLength); // DEBUG
+	return true;
+}
+
+// Starts playing backwards from the frame before the playhead, or speeds up when already playing
+// backwards. The index has to be complete.
+void startReversePlayback(ReversePlayback *rp, int playhead)
+{
+	VideoClip *clip = rp->clip;
+	if(!clip->indexComplete || playhead <= 0) return;
+
+	if(rp->active)
+	{
+		if(rp->speed < REVERSE_MAX_SPEED) rp->speed *= 2;
+		printf("Reverse playback at %dx\n", rp->speed); // DEBUG
+		return;
+	}
+	if(!rp->nworkers && !createReverseWorkers(rp)) return;
+
+	SDL_LockMutex(rp->lock);
+	rp->nextGop = gopForFrame(clip->vfile, playhead - 1);
+	SDL_CondBroadcast(rp->wake);
+	SDL_UnlockMutex(rp->lock);
+
+	rp->speed = 1;
+	rp->nextFrame = playhead - 1;
+	rp->active = true;
+}
+
+void stopReversePlayback(ReversePlayback *rp)
+{
+	if(!rp->active) return;
+
+	SDL_LockMutex(rp->lock);
+	SDL_AtomicIncRef(&rp->generation);
+	rp->nextGop = -1;
+	for(int i = 0; i < rp->nbuffers; ++i)
+	{
+		// Buffers being decoded are let go by their worker once it sees the cancel
+		if(rp->buffers[i].state == ReverseGop_Ready || rp->buffers[i].state == ReverseGop_Failed)
+		{
+			rp->buffers[i].state = ReverseGop_Free;
+			rp->buffers[i].gop = -1;
+		}
+	}
+	SDL_UnlockMutex(rp->lock);
+	rp->active = false;
+
+	printf("Reverse playback stopped: %llu frames shown, %llu underruns, %d GOPs decoded\n",
+	       rp->framesShown, rp->underruns, SDL_AtomicGet(&rp->gopsDecoded)); // DEBUG
+}
+
+inline bool reversePlaybackFinished(ReversePlayback *rp)
+{
+	return rp->active && rp->nextFrame < 0;
+}
+
+// Shows the next frame backwards and steps on by the current speed. Returns the frame's display
+// index, or -1 when its GOP is not decoded yet (an underrun), could not be decoded (playback goes on
+// from the GOP before it) or the start of the clip was reached.
+int presentNextReverseFrame(ReversePlayback *rp)
+{
+	if(!rp->active || rp->nextFrame < 0) return -1;
+	VideoClip *clip = rp->clip;
+	int index = rp->nextFrame;
+	int gop = gopForFrame(clip->vfile, index);
+
+	SDL_LockMutex(rp->lock);
+	ReverseGop *buffer = NULL;
+	for(int i = 0; i < rp->nbuffers; ++i)
+	{
+		ReverseGop *b = &rp->buffers[i];
+		if(b->gop == gop && (b->state == ReverseGop_Ready || b->state == ReverseGop_Failed))
+		{
+			buffer = b;
+		}
+	}
+	if(!buffer)
+	{
+		SDL_UnlockMutex(rp->lock);
+		rp->underruns++;
+		return -1;
+	}
+	if(buffer->state == ReverseGop_Failed)
+	{
+		rp->nextFrame = buffer->start - 1;
+		buffer->state = ReverseGop_Free;
+		buffer->gop = -1;
+		SDL_CondBroadcast(rp->wake);
+		SDL_UnlockMutex(rp->lock);
+		return -1;
+	}
+
+	uint8 *y = buffer->frames + ((uint64)(index - buffer->start) * rp->frameSz);
+	uint8 *u = y + clip->cache.yPlaneSz;
+	uint8 *v = u + clip->cache.uvPlaneSz;
+	uploadPlanes(clip, y, u, v);
+	rp->framesShown++;
+
+	// Every GOP after the one the next frame is in is done with. At high speeds whole GOPs can be
+	// stepped over, those are let go here too.
+	rp->nextFrame = index - rp->speed;
+	int nextGop = (rp->nextFrame >= 0) ? gopForFrame(clip->vfile, rp->nextFrame) : -1;
+	bool freed = false;
+	for(int i = 0; i < rp->nbuffers; ++i)
+	{
+		ReverseGop *b = &rp->buffers[i];
+		if((b->state == ReverseGop_Ready || b->state == ReverseGop_Failed) && b->gop > nextGop)
+		{
+			b->state = ReverseGop_Free;
+			b->gop = -1;
+			freed = true;
+		}
+	}
+	if(freed) SDL_CondBroadcast(rp->wake);
+	SDL_UnlockMutex(rp->lock);
+	return index;
+}
+
+void freeReversePlayback(ReversePlayback *rp)
+{
+	if(!rp->lock) return;
+	stopReversePlayback(rp);
+	SDL_AtomicSet(&rp->quit, 1);
+	SDL_LockMutex(rp->lock);
+	SDL_CondBroadcast(rp->wake);
+	SDL_UnlockMutex(rp->lock);
+	for(int i = 0; i < rp->nworkers; ++i)
+	{
+		SDL_WaitThread(rp->workers[i].thread, NULL);
+		rp->workers[i] = ReverseWorker();
+	}
+	rp->nworkers = 0;
+	for(int i = 0; i < rp->nbuffers; ++i)
+	{
+		free(rp->buffers[i].frames);
+	}
+	free(rp->buffers);
+	rp->buffers = NULL;
+	rp->nbuffers = 0;
+	SDL_DestroyCond(rp->wake);
+	SDL_DestroyMutex(rp->lock);
+	rp->wake = NULL;
+	rp->lock = NULL;
+}
+
+#endif
@@ -0,0 +1,201 @@
+#ifndef SCRUB_H
+#define SCRUB_H
+
+#include "decoder.h"
+
+// Scrub images are 1/SCRUB_SCALE of the video in each direction. If an image of every frame does
+// not fit in SCRUB_CACHE_MEGABYTES only every Nth frame is kept.
+#define SCRUB_SCALE           8
+#define SCRUB_CACHE_MEGABYTES 256
+// How long the mouse has to rest while dragging before the full resolution frame is decoded
+#define SCRUB_SETTLE_MS       120
+
+// NOTE: A tiny image of (nearly) every frame, built by a low priority background thread with its
+// own decoder. GOPs closest to the playhead are decoded first so the area the user is looking at
+// fills in first. While dragging on the timeline the nearest scrub image is shown immediately and
+// the full frame is only decoded once the drag settles.
+//
+// The images are written by the scrub thread only. An image may be read once its ready flag is
+// set, the flag is published after the image with a release barrier.
+struct ScrubCache
+{
+	VideoClip    *clip;
+	SDL_Thread   *thread     = NULL;
+	SDL_Texture  *texture    = NULL;
+	uint8        *images     = NULL;
+	uint8        *ready      = NULL; // One flag per image
+	uint8        *gopDone    = NULL; // One flag per GOP, only touched by the scrub thread
+	SwsContext   *swsCtx     = NULL;
+	int           width      = 0;
+	int           height     = 0;
+	int           imageSz    = 0;
+	int           step       = 1;    // Every step-th frame has an image
+	int           nimages    = 0;
+	SDL_atomic_t  playhead;
+	SDL_atomic_t  quit;
+	SDL_atomic_t  nready;
+	bool          showing    = false; // The scrub image is on screen instead of the clip's texture
+	int           shownFrame = -1;
+};
+
+internal void storeScrubImage(void *userdata, int index, AVFrame *frame)
+{
+	ScrubCache *scrub = (ScrubCache *)userdata;
+	if(index % scrub->step != 0) return;
+	int slot = index / scrub->step;
+	if(slot >= scrub->nimages || scrub->ready[slot]) return;
+
+	uint8 *image = scrub->images + ((uint64)slot * scrub->imageSz);
+	int ySz = scrub->width * scrub->height;
+	uint8 *data[4] = { image, image + ySz, image + ySz + (ySz / 4), NULL };
+	int linesize[4] = { scrub->width, scrub->width / 2, scrub->width / 2, 0 };
+	sws_scale(scrub->swsCtx, (uint8 const * const *)frame->data, frame->linesize,
+	          0, frame->height, data, linesize);
+
+	SDL_MemoryBarrierRelease();
+	scrub->ready[slot] = 1;
+	SDL_AtomicIncRef(&scrub->nready);
+}
+
+// Picks the GOP nearest to the playhead that has not been done yet, -1 when all are done.
+internal int nextScrubGop(ScrubCache *scrub)
+{
+	VideoFile *vfile = scrub->clip->vfile;
+	int playhead = SDL_AtomicGet(&scrub->playhead);
+	if(playhead >= (int)vfile->nframes) playhead = vfile->nframes - 1;
+	int center = gopForFrame(vfile, playhead);
+	int n = vfile->nkeyframes;
+	for(int distance = 0; distance < n; ++distance)
+	{
+		int after = center + distance;
+		int before = center - distance;
+		if(after < n && !scrub->gopDone[after]) return after;
+		if(before >= 0 && !scrub->gopDone[before]) return before;
+	}
+	return -1;
+}
+
+internal int scrubThread(void *data)
+{
+	ScrubCache *scrub = (ScrubCache *)data;
+	VideoClip *clip = scrub->clip;
+	VideoFile *vfile = clip->vfile;
+
+	SDL_SetThreadPriority(SDL_THREAD_PRIORITY_LOW);
+
+	// GOPs can only be found once the index is done
+	while(!frameIndexReady(vfile))
+	{
+		if(SDL_AtomicGet(&scrub->quit)) return 0;
+		SDL_Delay(50);
+	}
+
+	// Only now is the real frame count known
+	scrub->step = 1;
+	uint64 budget = (uint64)SCRUB_CACHE_MEGABYTES * 1024 * 1024;
+	while((uint64)((vfile->nframes + scrub->step - 1) / scrub->step) * scrub->imageSz > budget)
+	{
+		scrub->step++;
+	}
+	int nimages = (vfile->nframes + scrub->step - 1) / scrub->step;
+	scrub->images = (uint8 *)malloc((uint64)nimages * scrub->imageSz);
+	scrub->ready = (uint8 *)calloc(nimages, 1);
+	scrub->gopDone = (uint8 *)calloc(vfile->nkeyframes, 1);
+	SDL_MemoryBarrierRelease();
+	scrub->nimages = nimages;
+
+	Decoder dec;
+	if(!openDecoder(&dec, vfile)) return 0;
+	scrub->swsCtx = sws_getContext(vfile->width, vfile->height, dec.codecCtx->pix_fmt,
+	                               scrub->width, scrub->height, AV_PIX_FMT_YUV420P,
+	                               SWS_FAST_BILINEAR, NULL, NULL, NULL);
+
+	CancelToken cancel;
+	cancel.generation = &scrub->quit;
+	cancel.value = 0;
+
+	uint64 start = (uint64)SDL_GetTicks();
+	int gop;
+	while(!SDL_AtomicGet(&scrub->quit) && (gop = nextScrubGop(scrub)) >= 0)
+	{
+		decodeGop(&dec, vfile, gop, cancel, storeScrubImage, scrub);
+		scrub->gopDone[gop] = 1;
+	}
+	if(!SDL_AtomicGet(&scrub->quit))
+	{
+		printf("Scrub cache: %d images of %dx%d, every %d frame(s)\n",
+		       SDL_AtomicGet(&scrub->nready), scrub->width, scrub->height, scrub->step);
+		printTiming("building scrub cache", (uint64)SDL_GetTicks() - start);
+	}
+
+	sws_freeContext(scrub->swsCtx);
+	scrub->swsCtx = NULL;
+	closeDecoder(&dec);
+	return 0;
+}
+
+void createScrubCache(ScrubCache *scrub, VideoClip *clip, SDL_Renderer *renderer)
+{
+	scrub->clip = clip;
+	// Keep the size even for the 4:2:0 chroma planes
+	scrub->width = ((clip->vfile->width / SCRUB_SCALE) + 1) & ~1;
+	scrub->height = ((clip->vfile->height / SCRUB_SCALE) + 1) & ~1;
+	scrub->imageSz = scrub->width * scrub->height * 3 / 2;
+	scrub->nimages = 0;
+	scrub->showing = false;
+	scrub->shownFrame = -1;
+	SDL_AtomicSet(&scrub->playhead, 0);
+	SDL_AtomicSet(&scrub->quit, 0);
+	SDL_AtomicSet(&scrub->nready, 0);
+	scrub->texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_YV12, SDL_TEXTUREACCESS_STREAMING,
+	                                   scrub->width, scrub->height);
+	scrub->thread = SDL_CreateThread(scrubThread, "MouseScrub", scrub);
+}
+
+// Shows the scrub image closest to the frame. Returns false if there is none nearby yet, in which
+// case the full frame has to be decoded.
+bool showScrubImage(ScrubCache *scrub, int frame)
+{
+	if(!scrub->nimages) return false;
+	SDL_MemoryBarrierAcquire();
+
+	int slot = -1;
+	int center = frame / scrub->step;
+	for(int distance = 0; distance <= 2 && slot < 0; ++distance)
+	{
+		if(center + distance < scrub->nimages && scrub->ready[center + distance]) slot = center + distance;
+		else if(center - distance >= 0 && scrub->ready[center - distance]) slot = center - distance;
+	}
+	if(slot < 0) return false;
+	SDL_MemoryBarrierAcquire();
+
+	uint8 *image = scrub->images + ((uint64)slot * scrub->imageSz);
+	int ySz = scrub->width * scrub->height;
+	SDL_UpdateYUVTexture(scrub->texture, NULL, image, scrub->width,
+	                     image + ySz, scrub->width / 2, image + ySz + (ySz / 4), scrub->width / 2);
+	scrub->showing = true;
+	scrub->shownFrame = frame;
+	return true;
+}
+
+void freeScrubCache(ScrubCache *scrub)
+{
+	if(scrub->thread)
+	{
+		SDL_AtomicSet(&scrub->quit, 1);
+		SDL_WaitThread(scrub->thread, NULL);
+		scrub->thread = NULL;
+	}
+	if(scrub->texture) SDL_DestroyTexture(scrub->texture);
+	scrub->texture = NULL;
+	free(scrub->images);
+	free(scrub->ready);
+	free(scrub->gopDone);
+	scrub->images = NULL;
+	scrub->ready = NULL;
+	scrub->gopDone = NULL;
+	scrub->nimages = 0;
+	scrub->showing = false;
+}
+
+#endif
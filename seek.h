@@ -0,0 +1,275 @@
+#ifndef SEEK_H
+#define SEEK_H
+
+// NOTE: Asynchronous, latest-wins seeking for timeline dragging. The main thread only posts the
+// frame it wants, the seek thread always works on the newest request: posting a new target
+// cancels the decode that is in flight (see CancelToken in video.h) and requests that were never
+// started are simply overwritten. Finished frames are handed back through a result buffer that the
+// main thread uploads to the texture. While the video is shown smaller the result is converted at
+// that size (displayThreadSize()), the landing frame still goes in the frame cache at full size.
+//
+// Seeks posted at draft quality (while the user drags) are decoded with the clip's draft codec
+// context, the caller posts the same frame again at full quality once the drag is over.
+//
+// While the seek thread is busy it owns the clip's decoder, frame, scaler, planes and frame cache.
+// Call cancelSeeks() before touching any of them from the main thread.
+//
+// A request is its target, quality and generation together. They are published and taken under
+// requestLock so the seek thread never runs an old target under a newer generation.
+struct SeekEngine
+{
+	VideoClip    *clip;
+	SDL_Thread   *thread       = NULL;
+	SDL_sem      *wake         = NULL;
+	SDL_mutex    *resultLock   = NULL;
+	SDL_mutex    *requestLock  = NULL;
+	SDL_atomic_t  pending;      // Newest frame asked for, -1 when there is nothing to do
+	SDL_atomic_t  pendingQuality;
+	SDL_atomic_t  generation;   // Bumped on every post/cancel, cancels the seek in flight
+	SDL_atomic_t  busy;
+	SDL_atomic_t  quit;
+	// Result, guarded by resultLock
+	uint8        *yPlane       = NULL;
+	uint8        *uPlane       = NULL;
+	uint8        *vPlane       = NULL;
+	int           resultFrame  = -1;
+	int           resultWidth  = 0;  // Size of the planes, the video's or the display size
+	int           resultHeight = 0;
+	DecodeQuality resultQuality = DecodeQuality_Full;
+	bool          resultReady  = false;
+	SwsContext   *scaleCtx     = NULL; // Seek thread only, to the display size
+	// Stats
+	SDL_atomic_t  posted;
+	SDL_atomic_t  completed;
+	SDL_atomic_t  cancelled;
+};
+
+internal int seekThread(void *data)
+{
+	SeekEngine *engine = (SeekEngine *)data;
+	VideoClip *clip = engine->clip;
+
+	while(!SDL_AtomicGet(&engine->quit))
+	{
+		// NOTE: busy has to be raised before the request is taken, cancelSeeks() relies on it
+		SDL_AtomicSet(&engine->busy, 1);
+		SDL_LockMutex(engine->requestLock);
+		int target = SDL_AtomicSet(&engine->pending, -1);
+		int generation = SDL_AtomicGet(&engine->generation);
+		DecodeQuality requested = (DecodeQuality)SDL_AtomicGet(&engine->pendingQuality);
+		SDL_UnlockMutex(engine->requestLock);
+		if(target < 0)
+		{
+			SDL_AtomicSet(&engine->busy, 0);
+			SDL_SemWaitTimeout(engine->wake, 100);
+			continue;
+		}
+
+		clip->cancel.generation = &engine->generation;
+		clip->cancel.value = generation;
+		clip->quality = requested;
+		DecodeQuality quality = DecodeQuality_Full;
+		VideoFile *vfile = clip->vfile;
+		int width = vfile->width;
+		int height = vfile->height;
+		int displayWidth, displayHeight;
+		bool scaled = displayThreadSize(clip, &displayWidth, &displayHeight);
+
+		// Uncompressed frames are copied straight out of the mapped file
+		SDL_LockMutex(engine->resultLock);
+		bool done = copyRawFrame(clip, target, engine->yPlane, engine->uPlane, engine->vPlane);
+		if(!done) SDL_UnlockMutex(engine->resultLock);
+
+		CachedFrame *cached = NULL;
+		if(!done)
+		{
+			lockFrameCache(&clip->cache);
+			cached = frameCacheLookup(&clip->cache, target);
+			if(cached)
+			{
+				SDL_LockMutex(engine->resultLock);
+				const uint8 *data[3] = { cached->yPlane, cached->uPlane, cached->vPlane };
+				int linesize[3] = { vfile->width, clip->uvPitch, clip->uvPitch };
+				if(scaled && scalePictureTo(&engine->scaleCtx, data, linesize, AV_PIX_FMT_YUV420P,
+				                            vfile->width, vfile->height,
+				                            displayWidth, displayHeight,
+				                            engine->yPlane, engine->uPlane, engine->vPlane))
+				{
+					width = displayWidth;
+					height = displayHeight;
+				}
+				else
+				{
+					memcpy(engine->yPlane, cached->yPlane, clip->cache.yPlaneSz);
+					memcpy(engine->uPlane, cached->uPlane, clip->cache.uvPlaneSz);
+					memcpy(engine->vPlane, cached->vPlane, clip->cache.uvPlaneSz);
+				}
+				done = true;
+			}
+			unlockFrameCache(&clip->cache);
+		}
+		if(!done && decodeToFrame(clip, target))
+		{
+			SDL_LockMutex(engine->resultLock);
+			if(scaled && scaleFrameTo(&engine->scaleCtx, clip->frame, displayWidth, displayHeight,
+			                          engine->yPlane, engine->uPlane, engine->vPlane))
+			{
+				width = displayWidth;
+				height = displayHeight;
+			}
+			else
+			{
+				convertVideoClipFrameTo(clip, engine->yPlane, engine->uPlane, engine->vPlane);
+			}
+			quality = clip->quality;
+			done = true;
+		}
+
+		if(done)
+		{
+			// Don't hand back a frame that was superseded while it was being copied
+			if(!seekCancelled(clip))
+			{
+				engine->resultFrame = target;
+				engine->resultWidth = width;
+				engine->resultHeight = height;
+				engine->resultQuality = quality;
+				engine->resultReady = true;
+				SDL_AtomicIncRef(&engine->completed);
+			}
+			SDL_UnlockMutex(engine->resultLock);
+		}
+		else
+		{
+			SDL_AtomicIncRef(&engine->cancelled);
+		}
+
+		clip->cancel = CancelToken();
+		clip->quality = DecodeQuality_Full;
+		SDL_AtomicSet(&engine->busy, 0);
+	}
+	return 0;
+}
+
+void createSeekEngine(SeekEngine *engine, VideoClip *clip)
+{
+	engine->clip = clip;
+	engine->yPlane = (uint8 *)malloc(clip->cache.yPlaneSz);
+	engine->uPlane = (uint8 *)malloc(clip->cache.uvPlaneSz);
+	engine->vPlane = (uint8 *)malloc(clip->cache.uvPlaneSz);
+	engine->resultFrame = -1;
+	engine->resultReady = false;
+	engine->wake = SDL_CreateSemaphore(0);
+	engine->resultLock = SDL_CreateMutex();
+	engine->requestLock = SDL_CreateMutex();
+	SDL_AtomicSet(&engine->pending, -1);
+	SDL_AtomicSet(&engine->pendingQuality, DecodeQuality_Full);
+	SDL_AtomicSet(&engine->generation, 0);
+	SDL_AtomicSet(&engine->busy, 0);
+	SDL_AtomicSet(&engine->quit, 0);
+	SDL_AtomicSet(&engine->posted, 0);
+	SDL_AtomicSet(&engine->completed, 0);
+	SDL_AtomicSet(&engine->cancelled, 0);
+	engine->thread = SDL_CreateThread(seekThread, "MouseSeeker", engine);
+}
+
+// Asks for a frame. Whatever the seek thread is doing right now is cancelled.
+void postSeek(SeekEngine *engine, int frame, DecodeQuality quality)
+{
+	SDL_AtomicIncRef(&engine->posted);
+	SDL_LockMutex(engine->requestLock);
+	SDL_AtomicIncRef(&engine->generation);
+	SDL_AtomicSet(&engine->pendingQuality, quality);
+	SDL_AtomicSet(&engine->pending, frame);
+	SDL_UnlockMutex(engine->requestLock);
+	SDL_SemPost(engine->wake);
+}
+
+inline bool seekEngineIdle(SeekEngine *engine)
+{
+	return !SDL_AtomicGet(&engine->busy) && SDL_AtomicGet(&engine->pending) < 0;
+}
+
+// Drops any pending request, cancels the one in flight and waits until the seek thread lets go
+// of the decoder. A result that was not presented yet is dropped as well.
+void cancelSeeks(SeekEngine *engine)
+{
+	if(!engine->thread) return;
+	SDL_LockMutex(engine->requestLock);
+	SDL_AtomicIncRef(&engine->generation);
+	SDL_AtomicSet(&engine->pending, -1);
+	SDL_UnlockMutex(engine->requestLock);
+	while(SDL_AtomicGet(&engine->busy))
+	{
+		SDL_Delay(0);
+	}
+	SDL_LockMutex(engine->resultLock);
+	engine->resultReady = false;
+	SDL_UnlockMutex(engine->resultLock);
+}
+
+// Like cancelSeeks() but does not wait for the seek thread to let go of the decoder, for when the
+// caller only wants to make sure no older frame shows up on screen.
+void dropSeeks(SeekEngine *engine)
+{
+	if(!engine->thread) return;
+	SDL_LockMutex(engine->requestLock);
+	SDL_AtomicIncRef(&engine->generation);
+	SDL_AtomicSet(&engine->pending, -1);
+	SDL_UnlockMutex(engine->requestLock);
+	SDL_LockMutex(engine->resultLock);
+	engine->resultReady = false;
+	SDL_UnlockMutex(engine->resultLock);
+}
+
+// Uploads the newest finished seek, if there is one. Returns the frame that is now on screen or
+// -1 when nothing new arrived.
+int presentSeekResult(SeekEngine *engine)
+{
+	int frame = -1;
+	if(SDL_TryLockMutex(engine->resultLock) != 0) return -1;
+	if(engine->resultReady)
+	{
+		VideoClip *clip = engine->clip;
+		if(uploadPlanesOfSize(clip, engine->yPlane, engine->uPlane, engine->vPlane,
+		                      engine->resultWidth, engine->resultHeight))
+		{
+			clip->shownQuality = engine->resultQuality;
+			frame = engine->resultFrame;
+		}
+		engine->resultReady = false;
+	}
+	SDL_UnlockMutex(engine->resultLock);
+	return frame;
+}
+
+void freeSeekEngine(SeekEngine *engine)
+{
+	if(engine->thread)
+	{
+		cancelSeeks(engine);
+		SDL_AtomicSet(&engine->quit, 1);
+		SDL_SemPost(engine->wake);
+		SDL_WaitThread(engine->thread, NULL);
+		engine->thread = NULL;
+		printf("Seeks: %d posted, %d completed, %d cancelled\n",
+		       SDL_AtomicGet(&engine->posted), SDL_AtomicGet(&engine->completed),
+		       SDL_AtomicGet(&engine->cancelled)); // DEBUG
+	}
+	free(engine->yPlane);
+	free(engine->uPlane);
+	free(engine->vPlane);
+	engine->yPlane = NULL;
+	engine->uPlane = NULL;
+	engine->vPlane = NULL;
+	sws_freeContext(engine->scaleCtx);
+	engine->scaleCtx = NULL;
+	if(engine->wake) SDL_DestroySemaphore(engine->wake);
+	if(engine->resultLock) SDL_DestroyMutex(engine->resultLock);
+	if(engine->requestLock) SDL_DestroyMutex(engine->requestLock);
+	engine->wake = NULL;
+	engine->resultLock = NULL;
+	engine->requestLock = NULL;
+}
+
+#endif
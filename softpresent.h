@@ -0,0 +1,404 @@
+#ifndef SOFTPRESENT_H
+#define SOFTPRESENT_H
+
+// Slice threads that share a blit with the main thread, and the rows in each slice
+#define SOFTPRESENT_MAX_THREADS 8
+#define SOFTPRESENT_SLICE_ROWS  16
+
+// NOTE: Software presentation, for hosts where only SDL's software renderer is available. There
+// every frame would be uploaded into a YV12 texture, converted to RGB by SDL and then scaled by
+// SDL_RenderCopy(). Instead the frame's planes are kept as they are (uploads go to the clip's
+// shownPlanes, see upload.h) and the video is converted and scaled (nearest neighbour, like the
+// software renderer) straight into the window surface at videoRect, clipped to the view. Rows are
+// split into slices which the slice threads and the main thread take turns on.
+//
+// The software renderer draws into the window surface right away, the UI around the video still
+// goes through SDL_Renderer and the blit takes the place of the video's SDL_RenderCopy(), so the
+// drawing order does not change. SDL_RenderPresent() puts the surface on screen.
+
+struct SoftPresenter;
+
+// The destination pixel format, 32 bits with 8 bits per colour
+struct SoftPixelFormat
+{
+	int    rShift;
+	int    gShift;
+	int    bShift;
+	uint32 alpha;
+};
+
+typedef void (*SoftRowFn)(const uint8 *y, const uint8 *u, const uint8 *v, uint32 *dst, int width,
+                          SoftPixelFormat *format);
+
+struct SoftSliceWorker
+{
+	SoftPresenter *sp;
+	SDL_Thread    *thread   = NULL;
+	uint8         *rowY     = NULL; // A source row resampled to the destination width
+	uint8         *rowU     = NULL;
+	uint8         *rowV     = NULL;
+	int            capacity = 0;
+};
+
+// What the slices of the current blit work on, written by the main thread before the slice
+// threads are woken up.
+struct SoftBlit
+{
+	const uint8    *yPlane;
+	const uint8    *uPlane;
+	const uint8    *vPlane;
+	int             srcWidth;
+	int             srcHeight;
+	uint8          *pixels;
+	int             pitch;
+	SDL_Rect        dst;    // Clipped destination
+	SDL_Rect        full;   // The whole video rectangle, for mapping back to the source
+	int            *xmap;   // Source column of every destination column
+	SoftPixelFormat format;
+	SoftRowFn       row;
+};
+
+struct SoftPresenter
+{
+	bool            active     = false;
+	SDL_Window     *window     = NULL;
+	SoftSliceWorker workers[SOFTPRESENT_MAX_THREADS + 1]; // The main thread is workers[0]
+	int             nworkers   = 0;  // Slice threads, without the main thread
+	SDL_sem        *start      = NULL;
+	SDL_sem        *done       = NULL;
+	SDL_atomic_t    nextSlice;
+	SDL_atomic_t    quit;
+	SoftBlit        blit;
+	int            *xmap       = NULL;
+	int             xmapCapacity = 0;
+	SoftRowFn       row        = NULL;
+	const char     *rowName    = "none";
+	uint64          framesBlitted = 0;
+};
+
+inline int sat16(int value)
+{
+	return (value < -32768) ? -32768 : ((value > 32767) ? 32767 : value);
+}
+
+inline uint32 clampChannel(int value)
+{
+	return (value < 0) ? 0 : ((value > 255) ? 255 : (uint32)value);
+}
+
+// BT.601 limited range in 6-bit fixed point, the sums saturate at 16 bits like the SSE2 kernel.
+internal void yuvRowToRGBScalar(const uint8 *y, const uint8 *u, const uint8 *v, uint32 *dst,
+                                int width, SoftPixelFormat *format)
+{
+	for(int x = 0; x < width; ++x)
+	{
+		int luma = (y[x] - 16) * 75;
+		int cb = u[x] - 128;
+		int cr = v[x] - 128;
+		uint32 r = clampChannel(sat16(luma + cr * 102) >> 6);
+		uint32 g = clampChannel(sat16(sat16(luma - cb * 25) - cr * 52) >> 6);
+		uint32 b = clampChannel(sat16(luma + cb * 129) >> 6);
+		dst[x] = (r << format->rShift) | (g << format->gShift) | (b << format->bShift) |
+			format->alpha;
+	}
+}
+
+// Eight pixels at a time in 16-bit lanes, the channels are widened to 32 bits and shifted into
+// place separately so any byte order of the surface works.
+internal void yuvRowToRGBSSE2(const uint8 *y, const uint8 *u, const uint8 *v, uint32 *dst,
+                              int width, SoftPixelFormat *format)
+{
+	__m128i zero = _mm_setzero_si128();
+	__m128i lumaOffset = _mm_set1_epi16(16);
+	__m128i chromaOffset = _mm_set1_epi16(128);
+	__m128i alpha = _mm_set1_epi32((int)format->alpha);
+	__m128i rShift = _mm_cvtsi32_si128(format->rShift);
+	__m128i gShift = _mm_cvtsi32_si128(format->gShift);
+	__m128i bShift = _mm_cvtsi32_si128(format->bShift);
+	int x = 0;
+	for(; x + 8 <= width; x += 8)
+	{
+		__m128i luma = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(y + x)), zero);
+		__m128i cb = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(u + x)), zero);
+		__m128i cr = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(v + x)), zero);
+		luma = _mm_mullo_epi16(_mm_sub_epi16(luma, lumaOffset), _mm_set1_epi16(75));
+		cb = _mm_sub_epi16(cb, chromaOffset);
+		cr = _mm_sub_epi16(cr, chromaOffset);
+
+		__m128i r = _mm_adds_epi16(luma, _mm_mullo_epi16(cr, _mm_set1_epi16(102)));
+		__m128i g = _mm_subs_epi16(_mm_subs_epi16(luma, _mm_mullo_epi16(cb, _mm_set1_epi16(25))),
+		                           _mm_mullo_epi16(cr, _mm_set1_epi16(52)));
+		__m128i b = _mm_adds_epi16(luma, _mm_mullo_epi16(cb, _mm_set1_epi16(129)));
+		// Clamped to bytes and back to 16 bits
+		r = _mm_unpacklo_epi8(_mm_packus_epi16(_mm_srai_epi16(r, 6), zero), zero);
+		g = _mm_unpacklo_epi8(_mm_packus_epi16(_mm_srai_epi16(g, 6), zero), zero);
+		b = _mm_unpacklo_epi8(_mm_packus_epi16(_mm_srai_epi16(b, 6), zero), zero);
+
+		__m128i lo = _mm_or_si128(_mm_sll_epi32(_mm_unpacklo_epi16(r, zero), rShift), alpha);
+		lo = _mm_or_si128(lo, _mm_sll_epi32(_mm_unpacklo_epi16(g, zero), gShift));
+		lo = _mm_or_si128(lo, _mm_sll_epi32(_mm_unpacklo_epi16(b, zero), bShift));
+		__m128i hi = _mm_or_si128(_mm_sll_epi32(_mm_unpackhi_epi16(r, zero), rShift), alpha);
+		hi = _mm_or_si128(hi, _mm_sll_epi32(_mm_unpackhi_epi16(g, zero), gShift));
+		hi = _mm_or_si128(hi, _mm_sll_epi32(_mm_unpackhi_epi16(b, zero), bShift));
+		_mm_storeu_si128((__m128i *)(dst + x), lo);
+		_mm_storeu_si128((__m128i *)(dst + x + 4), hi);
+	}
+	yuvRowToRGBScalar(y + x, u + x, v + x, dst + x, width - x, format);
+}
+
+// Same check as checkDitherKernels(): every Y, U and V value through both kernels, with a tail.
+bool checkSoftRowKernel(SoftRowFn row, SoftPixelFormat *format)
+{
+	const int width = 259;
+	uint8 y[width];
+	uint8 u[width];
+	uint8 v[width];
+	uint32 expected[width];
+	uint32 result[width];
+	for(int pass = 0; pass < 256; ++pass)
+	{
+		for(int x = 0; x < width; ++x)
+		{
+			y[x] = (uint8)(x + pass);
+			u[x] = (uint8)(x * 7 + pass * 3);
+			v[x] = (uint8)(x * 13 + pass * 5);
+		}
+		yuvRowToRGBScalar(y, u, v, expected, width, format);
+		row(y, u, v, result, width, format);
+		if(memcmp(expected, result, width * sizeof(uint32)) != 0) return false;
+	}
+	return true;
+}
+
+internal bool softPixelFormat(SDL_Surface *surface, SoftPixelFormat *format)
+{
+	SDL_PixelFormat *pf = surface->format;
+	if(pf->BytesPerPixel != 4 || pf->Rloss || pf->Gloss || pf->Bloss) return false;
+	format->rShift = pf->Rshift;
+	format->gShift = pf->Gshift;
+	format->bShift = pf->Bshift;
+	format->alpha = pf->Amask;
+	return true;
+}
+
+internal void reserveSoftRows(SoftSliceWorker *worker, int width)
+{
+	if(worker->capacity >= width) return;
+	free(worker->rowY);
+	free(worker->rowU);
+	free(worker->rowV);
+	worker->rowY = (uint8 *)malloc(width);
+	worker->rowU = (uint8 *)malloc(width);
+	worker->rowV = (uint8 *)malloc(width);
+	worker->capacity = width;
+}
+
+// Converts slices until none are left.
+internal void blitSoftSlices(SoftPresenter *sp, SoftSliceWorker *worker)
+{
+	SoftBlit *blit = &sp->blit;
+	int nslices = (blit->dst.h + SOFTPRESENT_SLICE_ROWS - 1) / SOFTPRESENT_SLICE_ROWS;
+	int uvWidth = blit->srcWidth / 2;
+	for(;;)
+	{
+		int slice = SDL_AtomicAdd(&sp->nextSlice, 1);
+		if(slice >= nslices) break;
+		int first = slice * SOFTPRESENT_SLICE_ROWS;
+		int end = first + SOFTPRESENT_SLICE_ROWS;
+		if(end > blit->dst.h) end = blit->dst.h;
+		for(int row = first; row < end; ++row)
+		{
+			int dstY = blit->dst.y + row;
+			int srcY = (int)((int64)(dstY - blit->full.y) * blit->srcHeight / blit->full.h);
+			const uint8 *y = blit->yPlane + (int64)srcY * blit->srcWidth;
+			const uint8 *u = blit->uPlane + (int64)(srcY / 2) * uvWidth;
+			const uint8 *v = blit->vPlane + (int64)(srcY / 2) * uvWidth;
+			for(int x = 0; x < blit->dst.w; ++x)
+			{
+				int srcX = blit->xmap[x];
+				worker->rowY[x] = y[srcX];
+				worker->rowU[x] = u[srcX / 2];
+				worker->rowV[x] = v[srcX / 2];
+			}
+			uint32 *dst = (uint32 *)(blit->pixels + (int64)dstY * blit->pitch) + blit->dst.x;
+			blit->row(worker->rowY, worker->rowU, worker->rowV, dst, blit->dst.w, &blit->format);
+		}
+	}
+}
+
+internal int softSliceThread(void *data)
+{
+	SoftSliceWorker *worker = (SoftSliceWorker *)data;
+	SoftPresenter *sp = worker->sp;
+	for(;;)
+	{
+		SDL_SemWait(sp->start);
+		if(SDL_AtomicGet(&sp->quit)) break;
+		blitSoftSlices(sp, worker);
+		SDL_SemPost(sp->done);
+	}
+	return 0;
+}
+
+// Creates the window's renderer. Unless software is forced an accelerated renderer is tried
+// first, when there is none (or SDL handed out its software renderer anyway) the video is
+// presented in software.
+SDL_Renderer *createRendererWithSoftPresenter(SoftPresenter *sp, SDL_Window *window, bool software)
+{
+	*sp = SoftPresenter();
+	SDL_Renderer *renderer = software ? NULL : SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED);
+	if(renderer)
+	{
+		SDL_RendererInfo info;
+		SDL_GetRendererInfo(renderer, &info);
+		if(!(info.flags & SDL_RENDERER_SOFTWARE)) return renderer;
+	}
+	else
+	{
+		renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_SOFTWARE);
+	}
+
+	SoftPixelFormat format;
+	SDL_Surface *surface = SDL_GetWindowSurface(window);
+	if(!renderer || !surface || !softPixelFormat(surface, &format))
+	{
+		printf("Software renderer without a 32-bit window surface, the video goes through "
+		       "SDL_RenderCopy().\n");
+		return renderer;
+	}
+
+	sp->row = yuvRowToRGBScalar;
+	sp->rowName = "scalar";
+	if(SDL_HasSSE2())
+	{
+		sp->row = yuvRowToRGBSSE2;
+		sp->rowName = "SSE2";
+	}
+	bool matches = checkSoftRowKernel(sp->row, &format);
+	assert(matches);
+	if(!matches)
+	{
+		sp->row = yuvRowToRGBScalar;
+		sp->rowName = "scalar";
+	}
+
+	sp->window = window;
+	sp->start = SDL_CreateSemaphore(0);
+	sp->done = SDL_CreateSemaphore(0);
+	SDL_AtomicSet(&sp->quit, 0);
+	int cores = SDL_GetCPUCount();
+	sp->nworkers = (cores - 1 < SOFTPRESENT_MAX_THREADS) ? cores - 1 : SOFTPRESENT_MAX_THREADS;
+	if(sp->nworkers < 0) sp->nworkers = 0;
+	for(int i = 0; i <= sp->nworkers; ++i)
+	{
+		sp->workers[i] = SoftSliceWorker();
+		sp->workers[i].sp = sp;
+		if(i > 0)
+		{
+			sp->workers[i].thread = SDL_CreateThread(softSliceThread, "MouseSoftBlit", &sp->workers[i]);
+		}
+	}
+	sp->active = true;
+	printf("Software presentation: %s kernel, %d slice threads.\n\n", sp->rowName,
+	       sp->nworkers); // DEBUG
+	return renderer;
+}
+
+// Makes the clip keep its frames for blitSoftVideo() instead of uploading them to the texture.
+// Call this right after createVideoClip(), while the main thread still owns the decoder.
+void enableSoftPresentation(SoftPresenter *sp, VideoClip *clip)
+{
+	if(!sp->active) return;
+	int yPlaneSz = clip->cache.yPlaneSz;
+	int uvPlaneSz = clip->cache.uvPlaneSz;
+	clip->shownPlanes[0] = (uint8 *)malloc(yPlaneSz);
+	clip->shownPlanes[1] = (uint8 *)malloc(uvPlaneSz);
+	clip->shownPlanes[2] = (uint8 *)malloc(uvPlaneSz);
+	memset(clip->shownPlanes[0], 16, yPlaneSz);
+	memset(clip->shownPlanes[1], 128, uvPlaneSz);
+	memset(clip->shownPlanes[2], 128, uvPlaneSz);
+	uploadDecodedFrame(clip, clip->frame);
+}
+
+// Draws the clip's current frame into the window surface at clip->videoRect, clipped to view.
+void blitSoftVideo(SoftPresenter *sp, VideoClip *clip, SDL_Rect *view)
+{
+	SDL_Surface *surface = SDL_GetWindowSurface(sp->window);
+	if(!surface || !clip->shownPlanes[0] || clip->videoRect.w <= 0 || clip->videoRect.h <= 0) return;
+
+	SoftBlit *blit = &sp->blit;
+	SDL_Rect bounds = { 0, 0, surface->w, surface->h };
+	SDL_Rect visible;
+	if(!SDL_IntersectRect(view, &bounds, &visible)) return;
+	if(!SDL_IntersectRect(&clip->videoRect, &visible, &blit->dst)) return;
+	// The surface is created again when the window is resized, its format may change with it
+	if(!softPixelFormat(surface, &blit->format)) return;
+
+	blit->full = clip->videoRect;
+	blit->yPlane = clip->shownPlanes[0];
+	blit->uPlane = clip->shownPlanes[1];
+	blit->vPlane = clip->shownPlanes[2];
+	blit->srcWidth = clip->vfile->width;
+	blit->srcHeight = clip->vfile->height;
+	blit->row = sp->row;
+
+	if(sp->xmapCapacity < blit->dst.w)
+	{
+		free(sp->xmap);
+		sp->xmap = (int *)malloc(blit->dst.w * sizeof(int));
+		sp->xmapCapacity = blit->dst.w;
+	}
+	for(int x = 0; x < blit->dst.w; ++x)
+	{
+		sp->xmap[x] = (int)((int64)(blit->dst.x + x - blit->full.x) * blit->srcWidth / blit->full.w);
+	}
+	blit->xmap = sp->xmap;
+	for(int i = 0; i <= sp->nworkers; ++i)
+	{
+		reserveSoftRows(&sp->workers[i], blit->dst.w);
+	}
+
+	if(SDL_MUSTLOCK(surface) && SDL_LockSurface(surface) != 0) return;
+	blit->pixels = (uint8 *)surface->pixels;
+	blit->pitch = surface->pitch;
+
+	SDL_AtomicSet(&sp->nextSlice, 0);
+	for(int i = 0; i < sp->nworkers; ++i)
+	{
+		SDL_SemPost(sp->start);
+	}
+	blitSoftSlices(sp, &sp->workers[0]);
+	for(int i = 0; i < sp->nworkers; ++i)
+	{
+		SDL_SemWait(sp->done);
+	}
+
+	if(SDL_MUSTLOCK(surface)) SDL_UnlockSurface(surface);
+	sp->framesBlitted++;
+}
+
+void freeSoftPresenter(SoftPresenter *sp)
+{
+	if(!sp->active) return;
+	SDL_AtomicSet(&sp->quit, 1);
+	for(int i = 0; i < sp->nworkers; ++i)
+	{
+		SDL_SemPost(sp->start);
+	}
+	for(int i = 0; i <= sp->nworkers; ++i)
+	{
+		SoftSliceWorker *worker = &sp->workers[i];
+		if(worker->thread) SDL_WaitThread(worker->thread, NULL);
+		free(worker->rowY);
+		free(worker->rowU);
+		free(worker->rowV);
+		*worker = SoftSliceWorker();
+	}
+	printf("Software presentation: %llu frames blitted\n", sp->framesBlitted); // DEBUG
+	free(sp->xmap);
+	SDL_DestroySemaphore(sp->start);
+	SDL_DestroySemaphore(sp->done);
+	*sp = SoftPresenter();
+}
+
+#endif
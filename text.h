@@ -0,0 +1,225 @@
+#ifndef TEXT_H
+#define TEXT_H
+
+// Printable ASCII, other characters are drawn as '?'
+#define GLYPH_FIRST 32
+#define GLYPH_LAST  126
+#define GLYPH_COUNT (GLYPH_LAST - GLYPH_FIRST + 1)
+#define GLYPH_ATLAS_WIDTH 512
+
+// Labels kept as whole textures, and the longest label that is kept
+#define TEXT_LABELS     16
+#define TEXT_LABEL_SIZE 256
+
+// NOTE: HUD text. Rendering a string with SDL_ttf allocates a surface and a texture each time, for
+// text that is drawn every frame that happens every frame. Instead every glyph of the font is
+// rendered once into one texture (the atlas) and a string is drawn as one SDL_RenderCopy() per
+// glyph from that texture, so text that changes all the time (the playhead) costs no allocations.
+// Text that rarely changes (the filename, the quality tier) is rendered whole once and kept as a
+// label, which keeps SDL_ttf's kerning. Glyphs and labels are rendered in white and tinted with
+// SDL_SetTextureColorMod() when drawn, so the colour is not part of what is kept.
+//
+// Main thread only, like everything else that touches the renderer.
+
+struct GlyphAtlas
+{
+	SDL_Texture *texture = NULL;
+	SDL_Rect     cells[GLYPH_COUNT]; // Where each glyph is in the texture
+	int          advance[GLYPH_COUNT];
+	int          height  = 0;
+};
+
+struct TextLabel
+{
+	char         text[TEXT_LABEL_SIZE];
+	SDL_Texture *texture = NULL;
+	int          w       = 0;
+	int          h       = 0;
+	uint32       lastUse = 0;
+};
+
+struct TextRenderer
+{
+	SDL_Renderer *renderer = NULL;
+	TTF_Font     *font     = NULL;
+	GlyphAtlas    atlas;
+	TextLabel     labels[TEXT_LABELS];
+	uint32        uses     = 0;
+};
+
+inline int glyphIndex(char c)
+{
+	unsigned char ch = (unsigned char)c;
+	if(ch < GLYPH_FIRST || ch > GLYPH_LAST) ch = '?';
+	return ch - GLYPH_FIRST;
+}
+
+// Renders every glyph into one surface, left to right in rows, then makes the atlas texture of it.
+internal bool createGlyphAtlas(GlyphAtlas *atlas, SDL_Renderer *renderer, TTF_Font *font)
+{
+	*atlas = GlyphAtlas();
+	SDL_Surface *glyphs[GLYPH_COUNT] = {};
+	int x = 0;
+	int y = 0;
+	int rowHeight = 0;
+	for(int i = 0; i < GLYPH_COUNT; ++i)
+	{
+		// A one character string comes out at the font's height with the glyph on the baseline
+		char text[2] = { (char)(GLYPH_FIRST + i), '\0' };
+		int minx, maxx, miny, maxy;
+		if(TTF_GlyphMetrics(font, (uint16)text[0], &minx, &maxx, &miny, &maxy, &atlas->advance[i]))
+		{
+			atlas->advance[i] = 0;
+		}
+		SDL_Surface *glyph = TTF_RenderText_Blended(font, text, SDLC_white);
+		glyphs[i] = glyph;
+		if(!glyph) continue;
+
+		if(x + glyph->w > GLYPH_ATLAS_WIDTH)
+		{
+			x = 0;
+			y += rowHeight;
+			rowHeight = 0;
+		}
+		atlas->cells[i] = { x, y, glyph->w, glyph->h };
+		x += glyph->w;
+		if(glyph->h > rowHeight) rowHeight = glyph->h;
+		if(glyph->h > atlas->height) atlas->height = glyph->h;
+	}
+
+	SDL_Surface *surface = SDL_CreateRGBSurface(0, GLYPH_ATLAS_WIDTH, y + rowHeight, 32, 0x00FF0000,
+	                                            0x0000FF00, 0x000000FF, 0xFF000000);
+	if(surface)
+	{
+		SDL_FillRect(surface, NULL, 0);
+		for(int i = 0; i < GLYPH_COUNT; ++i)
+		{
+			if(!glyphs[i]) continue;
+			// Copy the glyph's alpha as it is instead of blending it onto the empty atlas
+			SDL_SetSurfaceBlendMode(glyphs[i], SDL_BLENDMODE_NONE);
+			SDL_BlitSurface(glyphs[i], NULL, surface, &atlas->cells[i]);
+		}
+		atlas->texture = SDL_CreateTextureFromSurface(renderer, surface);
+		if(atlas->texture) SDL_SetTextureBlendMode(atlas->texture, SDL_BLENDMODE_BLEND);
+		SDL_FreeSurface(surface);
+	}
+	for(int i = 0; i < GLYPH_COUNT; ++i)
+	{
+		if(glyphs[i]) SDL_FreeSurface(glyphs[i]);
+	}
+	return atlas->texture != NULL;
+}
+
+bool createTextRenderer(TextRenderer *tr, SDL_Renderer *renderer, TTF_Font *font)
+{
+	*tr = TextRenderer();
+	tr->renderer = renderer;
+	tr->font = font;
+	if(!font || !createGlyphAtlas(&tr->atlas, renderer, font))
+	{
+		printf("Could not create the glyph atlas, HUD text is not drawn.\n"); // DEBUG
+		return false;
+	}
+	return true;
+}
+
+void freeTextRenderer(TextRenderer *tr)
+{
+	if(tr->atlas.texture) SDL_DestroyTexture(tr->atlas.texture);
+	for(int i = 0; i < TEXT_LABELS; ++i)
+	{
+		if(tr->labels[i].texture) SDL_DestroyTexture(tr->labels[i].texture);
+	}
+	*tr = TextRenderer();
+}
+
+// Width of the text as drawText() draws it
+int textWidth(TextRenderer *tr, const char *text)
+{
+	int width = 0;
+	for(const char *c = text; *c; ++c) width += tr->atlas.advance[glyphIndex(*c)];
+	return width;
+}
+
+inline int textHeight(TextRenderer *tr)
+{
+	return tr->atlas.height;
+}
+
+// Draws text that changes often from the atlas, x and y are the top left corner.
+void drawText(TextRenderer *tr, int x, int y, const char *text, SDL_Color color)
+{
+	GlyphAtlas *atlas = &tr->atlas;
+	if(!atlas->texture) return;
+	SDL_SetTextureColorMod(atlas->texture, color.r, color.g, color.b);
+	for(const char *c = text; *c; ++c)
+	{
+		int i = glyphIndex(*c);
+		SDL_Rect dst = { x, y, atlas->cells[i].w, atlas->cells[i].h };
+		if(dst.w > 0) SDL_RenderCopy(tr->renderer, atlas->texture, &atlas->cells[i], &dst);
+		x += atlas->advance[i];
+	}
+}
+
+// The label for text that rarely changes, rendered the first time it is asked for. When all
+// labels are taken the one used longest ago is replaced. NULL if the text can't be rendered (or is
+// too long to keep), draw it with drawText() then.
+TextLabel *textLabel(TextRenderer *tr, const char *text)
+{
+	if(!tr->font || strlen(text) >= TEXT_LABEL_SIZE) return NULL;
+	++tr->uses;
+	TextLabel *oldest = &tr->labels[0];
+	for(int i = 0; i < TEXT_LABELS; ++i)
+	{
+		TextLabel *label = &tr->labels[i];
+		if(label->texture && strcmp(label->text, text) == 0)
+		{
+			label->lastUse = tr->uses;
+			return label;
+		}
+		if(!label->texture || (oldest->texture && label->lastUse < oldest->lastUse)) oldest = label;
+	}
+
+	// Miss, only here is anything allocated
+	SDL_Surface *surface = TTF_RenderText_Blended(tr->font, text, SDLC_white);
+	if(!surface) return NULL;
+	SDL_Texture *texture = SDL_CreateTextureFromSurface(tr->renderer, surface);
+	int w = surface->w;
+	int h = surface->h;
+	SDL_FreeSurface(surface);
+	if(!texture) return NULL;
+
+	if(oldest->texture) SDL_DestroyTexture(oldest->texture);
+	strcpy(oldest->text, text);
+	oldest->texture = texture;
+	oldest->w = w;
+	oldest->h = h;
+	oldest->lastUse = tr->uses;
+	return oldest;
+}
+
+void drawTextLabel(TextRenderer *tr, TextLabel *label, int x, int y, SDL_Color color)
+{
+	SDL_Rect dst = { x, y, label->w, label->h };
+	SDL_SetTextureColorMod(label->texture, color.r, color.g, color.b);
+	SDL_RenderCopy(tr->renderer, label->texture, NULL, &dst);
+}
+
+// Draws text that rarely changes, x and y are the top left corner. textLabelSize() gives its size
+// to place it by.
+void drawLabel(TextRenderer *tr, int x, int y, const char *text, SDL_Color color)
+{
+	TextLabel *label = textLabel(tr, text);
+	if(label) drawTextLabel(tr, label, x, y, color);
+	else drawText(tr, x, y, text, color);
+}
+
+// Size of the text as drawLabel() draws it
+void textLabelSize(TextRenderer *tr, const char *text, int *w, int *h)
+{
+	TextLabel *label = textLabel(tr, text);
+	if(w) *w = label ? label->w : textWidth(tr, text);
+	if(h) *h = label ? label->h : textHeight(tr);
+}
+
+#endif
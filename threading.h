@@ -0,0 +1,174 @@
+#ifndef THREADING_H
+#define THREADING_H
+
+// NOTE: Decode threading policy. libavcodec can split a frame into slices and decode them in
+// parallel (slice threading, no added latency) or decode several frames at once (frame threading,
+// scales much better but every thread holds a frame back, so the first frame after a seek comes out
+// that many packets late). Playback only cares about throughput, an interactive seek about the
+// latency of a single frame, so the clip keeps one codec context for each (see DecodeMode) and
+// switches between them when it seeks.
+//
+// The policy for each mode comes from, in this order: the command line, an earlier calibration of
+// the same codec and resolution, or a short calibration decode on a worker thread (calibrate.h).
+// Until the calibration is done the defaults below are used.
+
+enum DecodeMode
+{
+	DecodeMode_Seek,
+	DecodeMode_Playback,
+	DecodeMode_Count
+};
+
+struct ThreadPolicy
+{
+	int threadCount = 1;  // 0 lets libavcodec pick
+	int threadType  = 0;  // FF_THREAD_FRAME and/or FF_THREAD_SLICE
+};
+
+struct DecodeThreading
+{
+	ThreadPolicy  policy[DecodeMode_Count]; // Wanted, only read by others once calibrated is set
+	ThreadPolicy  opened[DecodeMode_Count]; // What the codec contexts were opened with
+	SDL_Thread   *calibrationThread = NULL;
+	SDL_atomic_t  calibrated;
+	SDL_atomic_t  calibrationAbort;
+};
+
+// Policies given on the command line
+struct ThreadingOverride
+{
+	ThreadPolicy policy[DecodeMode_Count];
+	bool         set[DecodeMode_Count];
+};
+
+inline ThreadPolicy threadPolicy(int threadCount, int threadType)
+{
+	ThreadPolicy policy;
+	policy.threadCount = threadCount;
+	policy.threadType = threadType;
+	return policy;
+}
+
+inline ThreadPolicy defaultThreadPolicy(DecodeMode mode)
+{
+	if(mode == DecodeMode_Seek) return threadPolicy(0, FF_THREAD_SLICE);
+	return threadPolicy(0, FF_THREAD_FRAME | FF_THREAD_SLICE);
+}
+
+inline bool sameThreadPolicy(ThreadPolicy a, ThreadPolicy b)
+{
+	return a.threadCount == b.threadCount && a.threadType == b.threadType;
+}
+
+// Has to be called before avcodec_open2(), the threads can't be changed on an open context.
+inline void applyThreadPolicy(AVCodecContext *codecCtx, ThreadPolicy policy)
+{
+	codecCtx->thread_count = policy.threadCount;
+	codecCtx->thread_type = policy.threadType;
+}
+
+const char *threadTypeName(int threadType)
+{
+	if(threadType == (FF_THREAD_FRAME | FF_THREAD_SLICE)) return "frame+slice";
+	if(threadType == FF_THREAD_FRAME) return "frame";
+	if(threadType == FF_THREAD_SLICE) return "slice";
+	return "none";
+}
+
+const char *decodeModeName(DecodeMode mode)
+{
+	return (mode == DecodeMode_Seek) ? "seek" : "playback";
+}
+
+void printThreadPolicy(const char *message, DecodeMode mode, ThreadPolicy policy)
+{
+	if(policy.threadCount == 0)
+	{
+		printf("%s %s threading: %s, auto threads\n", message, decodeModeName(mode),
+		       threadTypeName(policy.threadType));
+	}
+	else
+	{
+		printf("%s %s threading: %s, %d threads\n", message, decodeModeName(mode),
+		       threadTypeName(policy.threadType), policy.threadCount);
+	}
+}
+
+void createDecodeThreading(DecodeThreading *threading)
+{
+	for(int mode = 0; mode < DecodeMode_Count; ++mode)
+	{
+		threading->policy[mode] = defaultThreadPolicy((DecodeMode)mode);
+		threading->opened[mode] = threading->policy[mode];
+	}
+	threading->calibrationThread = NULL;
+	SDL_AtomicSet(&threading->calibrated, 0);
+	SDL_AtomicSet(&threading->calibrationAbort, 0);
+}
+
+// True when the calibration picked a different policy than the mode's context was opened with.
+inline bool threadPolicyStale(DecodeThreading *threading, DecodeMode mode)
+{
+	return SDL_AtomicGet(&threading->calibrated) &&
+		!sameThreadPolicy(threading->policy[mode], threading->opened[mode]);
+}
+
+void stopThreadCalibration(DecodeThreading *threading)
+{
+	if(threading->calibrationThread)
+	{
+		SDL_AtomicSet(&threading->calibrationAbort, 1);
+		SDL_WaitThread(threading->calibrationThread, NULL);
+		threading->calibrationThread = NULL;
+	}
+}
+
+// Parses "<count>[,<frame|slice|frame+slice|none>]", a count of 0 means one thread per core.
+internal bool parseThreadPolicy(const char *value, ThreadPolicy *policy)
+{
+	char *end;
+	long count = strtol(value, &end, 10);
+	if(end == value || count < 0 || count > 64) return false;
+
+	ThreadPolicy result = threadPolicy((int)count, FF_THREAD_FRAME | FF_THREAD_SLICE);
+	if(*end == ',')
+	{
+		const char *type = end + 1;
+		if(strcmp(type, "frame+slice") == 0) result.threadType = FF_THREAD_FRAME | FF_THREAD_SLICE;
+		else if(strcmp(type, "frame") == 0) result.threadType = FF_THREAD_FRAME;
+		else if(strcmp(type, "slice") == 0) result.threadType = FF_THREAD_SLICE;
+		else if(strcmp(type, "none") == 0) result = threadPolicy(1, 0);
+		else return false;
+	}
+	else if(*end != '\0') return false;
+
+	*policy = result;
+	return true;
+}
+
+// Takes one of --threads=, --seek-threads= or --playback-threads= (both modes, or just the one).
+// Returns false for anything else.
+bool parseThreadingOption(const char *arg, ThreadingOverride *override)
+{
+	const char *options[] = { "--threads=", "--seek-threads=", "--playback-threads=" };
+	for(int i = 0; i < 3; ++i)
+	{
+		size_t length = strlen(options[i]);
+		if(strncmp(arg, options[i], length) != 0) continue;
+
+		ThreadPolicy policy;
+		if(!parseThreadPolicy(arg + length, &policy)) return false;
+		for(int mode = 0; mode < DecodeMode_Count; ++mode)
+		{
+			if(i == 0 || (i == 1 && mode == DecodeMode_Seek) || (i == 2 && mode == DecodeMode_Playback))
+			{
+				override->policy[mode] = policy;
+				override->set[mode] = true;
+			}
+		}
+		return true;
+	}
+	return false;
+}
+
+#endif
@@ -25,28 +25,6 @@ struct Point
 inline float fmax(float a, float b) { return a > b ? a : b ; }
 inline float fmin(float a, float b) { return a < b ? a : b ; }
 
-void DrawText(SDL_Renderer *renderer, TTF_Font *font, int x, int y, const char *text, 
-              SDL_Color color)
-{
-	SDL_Surface *surface;
-	if(surface = (TTF_RenderText_Blended(font, text, color)))
-	{
-		SDL_Texture *texture = SDL_CreateTextureFromSurface(renderer, surface);
-		if(texture)
-		{
-			SDL_Rect rect;
-			rect.x = x;
-			rect.y = y;
-			rect.w = surface->w;
-			rect.h = surface->h;
-
-			SDL_RenderCopy(renderer, texture, NULL, &rect);
-			SDL_DestroyTexture(texture);
-			SDL_FreeSurface(surface);
-		}
-	}
-}
-
 void setScrubberXPosition(VideoClip clip, ViewRects *views, int currentTime)
 {
 	if(currentTime > 0)
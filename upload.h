@@ -0,0 +1,519 @@
+#ifndef UPLOAD_H
+#define UPLOAD_H
+
+// NOTE: Frame conversion and texture upload paths. A decoded frame that already is YUV420P (or
+// YUVJ420P) at the video's size goes into the YV12 texture straight from the AVFrame's planes with
+// their own line sizes, an NV12 frame goes into the clip's NV12 texture the same way, and every
+// other format is converted into the clip's planes first (10/12-bit by the dither kernels, the
+// rest with sws_scale). Frames that are packed YUV420P planes already (frame cache, playback
+// queue, seek results, the mapped file) are uploaded as they are. Each upload counts the bytes it
+// copied, conversion included.
+// Converting into packed planes takes the same shortcut, direct frames are copied row by row.
+// Uploads are main thread only, conversion runs on whichever thread owns the frame.
+// While the video is shown smaller than it is, the playback and seek threads convert straight to
+// the size it is shown at (displayThreadSize()), the main thread only uploads those planes.
+
+inline bool evenSize(VideoFile *vfile)
+{
+	return !(vfile->width & 1) && !(vfile->height & 1);
+}
+
+// The frame's planes can be copied as they are into YUV420P planes of the video's size.
+inline bool directFrame(VideoFile *vfile, AVFrame *frame)
+{
+	return (frame->format == AV_PIX_FMT_YUV420P || frame->format == AV_PIX_FMT_YUVJ420P) &&
+		frame->width == vfile->width && frame->height == vfile->height && evenSize(vfile);
+}
+
+inline bool nv12Frame(VideoFile *vfile, AVFrame *frame)
+{
+	return frame->format == AV_PIX_FMT_NV12 &&
+		frame->width == vfile->width && frame->height == vfile->height && evenSize(vfile);
+}
+
+const char *uploadPathName(UploadPath path)
+{
+	switch(path)
+	{
+		case UploadPath_Direct: return "direct 4:2:0";
+		case UploadPath_NV12:   return "NV12";
+		case UploadPath_Sws:    return "sws_scale";
+		case UploadPath_Dither: return "dithered";
+		case UploadPath_Planes: return "packed planes";
+		case UploadPath_Scaled: return "scaled to display";
+		default:                return "unknown";
+	}
+}
+
+// Converts a full quality frame (or a smaller draft frame, see openDecodeContext()) into YUV420P
+// planes of the video's size. Only the thread that owns the clip's decoder may call this with a
+// frame that is not direct, the scalers are the clip's.
+void convertFrameTo(VideoClip *clip, AVFrame *frame, uint8 *yPlane, uint8 *uPlane, uint8 *vPlane)
+{
+	VideoFile *vfile = clip->vfile;
+	uint8 *data[4] = { yPlane, uPlane, vPlane, NULL };
+	int linesize[4] = { vfile->width, clip->uvPitch, clip->uvPitch, 0 };
+	if(directFrame(vfile, frame))
+	{
+		av_image_copy_plane(yPlane, linesize[0], frame->data[0], frame->linesize[0],
+		                    vfile->width, vfile->height);
+		av_image_copy_plane(uPlane, linesize[1], frame->data[1], frame->linesize[1],
+		                    clip->uvPitch, vfile->height / 2);
+		av_image_copy_plane(vPlane, linesize[2], frame->data[2], frame->linesize[2],
+		                    clip->uvPitch, vfile->height / 2);
+	}
+	else if(ditherFrame(frame, vfile->width, vfile->height))
+	{
+		ditherFrameTo(&clip->dither, frame, yPlane, uPlane, vPlane);
+	}
+	else if(frame->width != vfile->width || frame->height != vfile->height)
+	{
+		clip->draftSwsCtx = sws_getCachedContext(clip->draftSwsCtx, frame->width, frame->height,
+		                                         (AVPixelFormat)frame->format,
+		                                         vfile->width, vfile->height, AV_PIX_FMT_YUV420P,
+		                                         SWS_FAST_BILINEAR, NULL, NULL, NULL);
+		sws_scale(clip->draftSwsCtx, (uint8 const * const *)frame->data, frame->linesize,
+		          0, frame->height, data, linesize);
+	}
+	else
+	{
+		sws_scale(clip->swsCtx, (uint8 const * const *)frame->data, frame->linesize,
+		          0, vfile->height, data, linesize);
+	}
+}
+
+// Converts the decoder's current frame into the given YUV planes (sized like the clip's planes).
+inline void convertVideoClipFrameTo(VideoClip *clip, uint8 *yPlane, uint8 *uPlane, uint8 *vPlane)
+{
+	convertFrameTo(clip, clip->frame, yPlane, uPlane, vPlane);
+}
+
+// Converts the decoder's current full quality frame into the clip's YUV planes without touching
+// the texture. Nothing is done if the planes already hold it (clip->planesPts).
+void convertVideoClipFrame(VideoClip *clip)
+{
+	int64 pts = av_frame_get_best_effort_timestamp(clip->frame);
+	if(pts != AV_NOPTS_VALUE && pts == clip->planesPts) return;
+	convertVideoClipFrameTo(clip, clip->yPlane, clip->uPlane, clip->vPlane);
+	clip->planesPts = pts;
+}
+
+// Bytes in one frame of YUV420P planes (and in one NV12 frame) at the video's size
+inline uint64 uploadFrameBytes(VideoClip *clip)
+{
+	return (uint64)clip->cache.yPlaneSz + 2 * (uint64)clip->cache.uvPlaneSz;
+}
+
+// Bytes of YUV420P in the part of the video a full size upload copies
+inline uint64 uploadCropBytes(VideoClip *clip)
+{
+	return (uint64)clip->display.crop.w * clip->display.crop.h * 3 / 2;
+}
+
+inline void countUpload(VideoClip *clip, UploadPath path, uint64 bytes)
+{
+	clip->uploadStats.frames[path]++;
+	clip->uploadStats.bytes[path] += bytes;
+}
+
+void printUploadStats(UploadStats *stats)
+{
+	for(int path = 0; path < UploadPath_Count; ++path)
+	{
+		if(stats->frames[path] == 0) continue;
+		printf("Uploads (%s): %llu frames, %llu bytes copied per frame\n",
+		       uploadPathName((UploadPath)path), stats->frames[path],
+		       stats->bytes[path] / stats->frames[path]); // DEBUG
+	}
+}
+
+// NOTE: Display scaling. While the video is shown smaller than it is (videoRect narrower and
+// lower than the video) a 4K frame would be converted and uploaded at 4K only for the renderer to
+// shrink it. Instead every upload converts and scales the frame to the videoRect size in one
+// sws_scale() into a texture of that size. The size is only picked up by the next upload
+// (setDisplayView() says when the frame on screen should be shown again), the scaler contexts are
+// kept per source and target size so zooming back and forth does not rebuild them. At 1:1 or
+// closer the full size paths below are used. The software presenter scales in its own blit.
+//
+// Region of interest. Zoomed in far enough that videoRect sticks out of the view, only the part of
+// the video that is visible (plus a margin for panning) is copied into the full size texture (or
+// the software presenter's planes) and only that part is drawn. For 4:2:0 frames and packed planes
+// that part is all that is touched at all, other formats are still converted whole first. Once the
+// visible part pans out of what was uploaded (or the zoom changes it a lot) setDisplayView() asks
+// for the frame on screen to be uploaded again.
+
+void freeDisplayScale(DisplayScale *display)
+{
+	if(display->texture) SDL_DestroyTexture(display->texture);
+	if(display->width)
+	{
+		for(int i = 0; i < 3; ++i) free(display->planes[i]);
+	}
+	for(int i = 0; i < DISPLAY_SCALER_CONTEXTS; ++i)
+	{
+		sws_freeContext(display->scalers[i].ctx);
+	}
+	SDL_Renderer *renderer = display->renderer;
+	*display = DisplayScale();
+	display->renderer = renderer;
+}
+
+// Extra part of the video uploaded around the visible part on every side, as a fraction of it
+#define ROI_MARGIN_DIVISOR 4
+
+inline bool rectContains(SDL_Rect *outer, SDL_Rect *inner)
+{
+	return inner->x >= outer->x && inner->y >= outer->y &&
+		inner->x + inner->w <= outer->x + outer->w && inner->y + inner->h <= outer->y + outer->h;
+}
+
+// The part of the video that is visible in the view, the whole video if all of it is.
+internal SDL_Rect visibleVideoRect(VideoClip *clip, SDL_Rect *videoRect, SDL_Rect *view)
+{
+	int width = clip->vfile->width;
+	int height = clip->vfile->height;
+	SDL_Rect full = { 0, 0, width, height };
+	SDL_Rect visible;
+	if(videoRect->w <= 0 || videoRect->h <= 0 || !evenSize(clip->vfile) ||
+	   !SDL_IntersectRect(videoRect, view, &visible) || SDL_RectEquals(&visible, videoRect))
+	{
+		return full;
+	}
+	int64 left = visible.x - videoRect->x;
+	int64 top = visible.y - videoRect->y;
+	int64 right = left + visible.w;
+	int64 bottom = top + visible.h;
+	SDL_Rect result;
+	result.x = (int)(left * width / videoRect->w);
+	result.y = (int)(top * height / videoRect->h);
+	result.w = (int)((right * width + videoRect->w - 1) / videoRect->w) - result.x;
+	result.h = (int)((bottom * height + videoRect->h - 1) / videoRect->h) - result.y;
+	return result;
+}
+
+// The visible part grown by the margin and rounded out to whole chroma samples.
+internal SDL_Rect roiCrop(VideoClip *clip, SDL_Rect *visible)
+{
+	int marginX = visible->w / ROI_MARGIN_DIVISOR;
+	int marginY = visible->h / ROI_MARGIN_DIVISOR;
+	int left = visible->x - marginX;
+	int top = visible->y - marginY;
+	int right = visible->x + visible->w + marginX;
+	int bottom = visible->y + visible->h + marginY;
+	if(left < 0) left = 0;
+	if(top < 0) top = 0;
+	if(right > clip->vfile->width) right = clip->vfile->width;
+	if(bottom > clip->vfile->height) bottom = clip->vfile->height;
+	left &= ~1;
+	top &= ~1;
+	right = (right + 1) & ~1;
+	bottom = (bottom + 1) & ~1;
+	SDL_Rect crop = { left, top, right - left, bottom - top };
+	return crop;
+}
+
+// Takes where the video is shown and the view it is clipped to. Returns true when the frame on
+// screen should be uploaded again: it is now shown at a different size, or the part of it that is
+// visible was not uploaded.
+bool setDisplayView(VideoClip *clip, SDL_Rect *videoRect, SDL_Rect *view)
+{
+	DisplayScale *display = &clip->display;
+	bool reupload = false;
+	int wantWidth = 0;
+	int wantHeight = 0;
+	if(!clip->shownPlanes[0] && videoRect->w > 1 && videoRect->h > 1 &&
+	   videoRect->w < clip->vfile->width && videoRect->h < clip->vfile->height)
+	{
+		wantWidth = videoRect->w & ~1;
+		wantHeight = videoRect->h & ~1;
+	}
+	if(wantWidth != display->wantWidth || wantHeight != display->wantHeight)
+	{
+		display->wantWidth = wantWidth;
+		display->wantHeight = wantHeight;
+		SDL_AtomicSet(&display->threadSize, (wantWidth << 16) | wantHeight);
+		reupload = true;
+	}
+
+	SDL_Rect full = { 0, 0, clip->vfile->width, clip->vfile->height };
+	SDL_Rect visible = wantWidth ? full : visibleVideoRect(clip, videoRect, view);
+	if(SDL_RectEquals(&visible, &full))
+	{
+		if(!SDL_RectEquals(&display->crop, &full))
+		{
+			display->crop = full;
+			reupload = true;
+		}
+	}
+	else if(!rectContains(&display->crop, &visible) ||
+	        (uint64)visible.w * visible.h * 16 < (uint64)display->crop.w * display->crop.h)
+	{
+		// Also cropped again once the visible part is much smaller than what is uploaded
+		display->crop = roiCrop(clip, &visible);
+		reupload = true;
+	}
+	return reupload;
+}
+
+// Where the shown texture is drawn. Returns the part of the texture to draw (NULL for all of it),
+// dst gets the part of the screen it goes to.
+SDL_Rect *shownTextureRects(VideoClip *clip, SDL_Rect *src, SDL_Rect *dst)
+{
+	*dst = clip->videoRect;
+	SDL_Rect *crop = &clip->display.shownCrop;
+	int width = clip->vfile->width;
+	int height = clip->vfile->height;
+	if(clip->shownTexture != clip->texture || (crop->w == width && crop->h == height)) return NULL;
+
+	SDL_Rect *video = &clip->videoRect;
+	*src = *crop;
+	dst->x = video->x + (int)((int64)crop->x * video->w / width);
+	dst->y = video->y + (int)((int64)crop->y * video->h / height);
+	dst->w = video->x + (int)((int64)(crop->x + crop->w) * video->w / width) - dst->x;
+	dst->h = video->y + (int)((int64)(crop->y + crop->h) * video->h / height) - dst->y;
+	return src;
+}
+
+// Makes the texture and planes match the wanted size. False when uploading at full size.
+internal bool prepareDisplayScale(DisplayScale *display)
+{
+	if(display->width == display->wantWidth && display->height == display->wantHeight)
+	{
+		return display->width != 0;
+	}
+	if(display->texture) SDL_DestroyTexture(display->texture);
+	if(display->width)
+	{
+		for(int i = 0; i < 3; ++i) free(display->planes[i]);
+	}
+	display->texture = NULL;
+	display->width = display->wantWidth;
+	display->height = display->wantHeight;
+	if(!display->width) return false;
+
+	display->texture = SDL_CreateTexture(display->renderer, SDL_PIXELFORMAT_YV12,
+	                                     SDL_TEXTUREACCESS_STREAMING, display->width, display->height);
+	int ySz = display->width * display->height;
+	display->planes[0] = (uint8 *)malloc(ySz);
+	display->planes[1] = (uint8 *)malloc(ySz / 4);
+	display->planes[2] = (uint8 *)malloc(ySz / 4);
+	return true;
+}
+
+// The scaler from the given source to the display size, least recently used contexts go first.
+internal SwsContext *displayScaler(DisplayScale *display, int srcFormat, int srcWidth, int srcHeight)
+{
+	DisplayScalerEntry *entry = NULL;
+	for(int i = 0; i < DISPLAY_SCALER_CONTEXTS; ++i)
+	{
+		DisplayScalerEntry *e = &display->scalers[i];
+		if(e->ctx && e->srcFormat == srcFormat && e->srcWidth == srcWidth &&
+		   e->srcHeight == srcHeight && e->width == display->width && e->height == display->height)
+		{
+			entry = e;
+			break;
+		}
+		if(!entry || e->lastUse < entry->lastUse) entry = e;
+	}
+	if(entry->ctx == NULL || entry->srcFormat != srcFormat || entry->srcWidth != srcWidth ||
+	   entry->srcHeight != srcHeight || entry->width != display->width ||
+	   entry->height != display->height)
+	{
+		sws_freeContext(entry->ctx);
+		entry->ctx = sws_getContext(srcWidth, srcHeight, (AVPixelFormat)srcFormat,
+		                            display->width, display->height, AV_PIX_FMT_YUV420P,
+		                            SWS_FAST_BILINEAR, NULL, NULL, NULL);
+		entry->srcFormat = srcFormat;
+		entry->srcWidth = srcWidth;
+		entry->srcHeight = srcHeight;
+		entry->width = display->width;
+		entry->height = display->height;
+	}
+	entry->lastUse = ++display->uses;
+	return entry->ctx;
+}
+
+// Converts and scales any picture to the display size and uploads it. False if the video is not
+// shown smaller than it is, nothing is done then.
+internal bool uploadScaled(VideoClip *clip, const uint8 * const *data, const int *linesize,
+                           int format, int width, int height)
+{
+	DisplayScale *display = &clip->display;
+	if(clip->shownPlanes[0] || !prepareDisplayScale(display)) return false;
+	SwsContext *scaler = displayScaler(display, format, width, height);
+	if(!scaler) return false;
+
+	int pitch[4] = { display->width, display->width / 2, display->width / 2, 0 };
+	uint8 *planes[4] = { display->planes[0], display->planes[1], display->planes[2], NULL };
+	sws_scale(scaler, data, linesize, 0, height, planes, pitch);
+	SDL_UpdateYUVTexture(display->texture, NULL, planes[0], pitch[0], planes[1], pitch[1],
+	                     planes[2], pitch[2]);
+	clip->shownTexture = display->texture;
+	clip->shownQuality = DecodeQuality_Full;
+	uint64 bytes = (uint64)display->width * display->height * 3 / 2;
+	countUpload(clip, UploadPath_Scaled, 2 * bytes);
+	return true;
+}
+
+// The size decoding threads convert frames to for showing them. False while they convert at the
+// video's size (it is shown at 1:1 or larger, or presented in software). Any thread.
+inline bool displayThreadSize(VideoClip *clip, int *width, int *height)
+{
+	int size = SDL_AtomicGet(&clip->display.threadSize);
+	*width = size >> 16;
+	*height = size & 0xFFFF;
+	return size != 0;
+}
+
+// Converts and scales any picture into tightly packed YUV420P planes of the given size with the
+// caller's scaler, for threads converting at the display size. False if there is no scaler for it.
+bool scalePictureTo(SwsContext **ctx, const uint8 * const *data, const int *linesize, int format,
+                    int srcWidth, int srcHeight, int width, int height,
+                    uint8 *yPlane, uint8 *uPlane, uint8 *vPlane)
+{
+	*ctx = sws_getCachedContext(*ctx, srcWidth, srcHeight, (AVPixelFormat)format,
+	                            width, height, AV_PIX_FMT_YUV420P,
+	                            SWS_FAST_BILINEAR, NULL, NULL, NULL);
+	if(!*ctx) return false;
+	uint8 *planes[4] = { yPlane, uPlane, vPlane, NULL };
+	int pitch[4] = { width, width / 2, width / 2, 0 };
+	sws_scale(*ctx, data, linesize, 0, srcHeight, planes, pitch);
+	return true;
+}
+
+inline bool scaleFrameTo(SwsContext **ctx, AVFrame *frame, int width, int height,
+                         uint8 *yPlane, uint8 *uPlane, uint8 *vPlane)
+{
+	return scalePictureTo(ctx, (const uint8 * const *)frame->data, frame->linesize, frame->format,
+	                      frame->width, frame->height, width, height, yPlane, uPlane, vPlane);
+}
+
+// Puts YUV420P planes of the video's size into the YV12 texture, or into the clip's shown planes
+// when the video is presented in software (softpresent.h).
+// Only the crop is copied (see setDisplayView()).
+internal void updateClipYUV(VideoClip *clip, const uint8 *yPlane, int yPitch, const uint8 *uPlane,
+                            int uPitch, const uint8 *vPlane, int vPitch)
+{
+	SDL_Rect *crop = &clip->display.crop;
+	yPlane += (int64)crop->y * yPitch + crop->x;
+	uPlane += (int64)(crop->y / 2) * uPitch + (crop->x / 2);
+	vPlane += (int64)(crop->y / 2) * vPitch + (crop->x / 2);
+	if(clip->shownPlanes[0])
+	{
+		int width = clip->vfile->width;
+		int uvWidth = clip->uvPitch;
+		uint8 *y = clip->shownPlanes[0] + (int64)crop->y * width + crop->x;
+		uint8 *u = clip->shownPlanes[1] + (int64)(crop->y / 2) * uvWidth + (crop->x / 2);
+		uint8 *v = clip->shownPlanes[2] + (int64)(crop->y / 2) * uvWidth + (crop->x / 2);
+		av_image_copy_plane(y, width, yPlane, yPitch, crop->w, crop->h);
+		av_image_copy_plane(u, uvWidth, uPlane, uPitch, crop->w / 2, crop->h / 2);
+		av_image_copy_plane(v, uvWidth, vPlane, vPitch, crop->w / 2, crop->h / 2);
+	}
+	else
+	{
+		SDL_UpdateYUVTexture(clip->texture, crop, yPlane, yPitch, uPlane, uPitch, vPlane, vPitch);
+	}
+	clip->display.shownCrop = *crop;
+}
+
+// Uploads tightly packed YUV420P planes of the video's size.
+void uploadPlanes(VideoClip *clip, const uint8 *yPlane, const uint8 *uPlane, const uint8 *vPlane)
+{
+	const uint8 *data[3] = { yPlane, uPlane, vPlane };
+	int linesize[3] = { clip->vfile->width, clip->uvPitch, clip->uvPitch };
+	if(uploadScaled(clip, data, linesize, AV_PIX_FMT_YUV420P, clip->vfile->width, clip->vfile->height))
+	{
+		return;
+	}
+	updateClipYUV(clip, yPlane, clip->vfile->width, uPlane, clip->uvPitch, vPlane, clip->uvPitch);
+	clip->shownTexture = clip->texture;
+	clip->shownQuality = DecodeQuality_Full;
+	countUpload(clip, UploadPath_Planes, uploadCropBytes(clip));
+}
+
+// Uploads tightly packed YUV420P planes of the video's size or of the display size a decoding
+// thread converted them to. False if they are display sized but the video is shown at another
+// size by now, they are not shown then (setDisplayView() asks for the frame again, playback is
+// on to the next one).
+bool uploadPlanesOfSize(VideoClip *clip, const uint8 *yPlane, const uint8 *uPlane,
+                        const uint8 *vPlane, int width, int height)
+{
+	if(width == clip->vfile->width && height == clip->vfile->height)
+	{
+		uploadPlanes(clip, yPlane, uPlane, vPlane);
+		return true;
+	}
+	DisplayScale *display = &clip->display;
+	if(clip->shownPlanes[0] || width != display->wantWidth || height != display->wantHeight ||
+	   !prepareDisplayScale(display))
+	{
+		return false;
+	}
+	SDL_UpdateYUVTexture(display->texture, NULL, yPlane, width, uPlane, width / 2,
+	                     vPlane, width / 2);
+	clip->shownTexture = display->texture;
+	clip->shownQuality = DecodeQuality_Full;
+	countUpload(clip, UploadPath_Scaled, (uint64)width * height * 3 / 2);
+	return true;
+}
+
+// NOTE: SDL 2.0.4 has no SDL_UpdateNVTexture(), so the NV12 texture is locked and both planes are
+// copied row by row (the interleaved UV plane follows the Y plane at the same pitch).
+internal bool uploadNV12Frame(VideoClip *clip, AVFrame *frame)
+{
+	void *pixels;
+	int pitch;
+	if(!clip->nv12Texture || SDL_LockTexture(clip->nv12Texture, NULL, &pixels, &pitch) != 0)
+	{
+		return false;
+	}
+	int width = clip->vfile->width;
+	int height = clip->vfile->height;
+	uint8 *dst = (uint8 *)pixels;
+	av_image_copy_plane(dst, pitch, frame->data[0], frame->linesize[0], width, height);
+	av_image_copy_plane(dst + (pitch * height), pitch, frame->data[1], frame->linesize[1],
+	                    width, height / 2);
+	SDL_UnlockTexture(clip->nv12Texture);
+	return true;
+}
+
+// Uploads a frame as it came out of a full quality decode and returns the path it took. The frame
+// is the clip's (while the main thread owns the decoder) or a direct one from the playback queue.
+UploadPath uploadDecodedFrame(VideoClip *clip, AVFrame *frame)
+{
+	VideoFile *vfile = clip->vfile;
+	if(uploadScaled(clip, frame->data, frame->linesize, frame->format, frame->width, frame->height))
+	{
+		return UploadPath_Scaled;
+	}
+	UploadPath path = UploadPath_Sws;
+	if(directFrame(vfile, frame))
+	{
+		updateClipYUV(clip, frame->data[0], frame->linesize[0], frame->data[1], frame->linesize[1],
+		              frame->data[2], frame->linesize[2]);
+		clip->shownTexture = clip->texture;
+		path = UploadPath_Direct;
+	}
+	else if(nv12Frame(vfile, frame) && !clip->shownPlanes[0] && uploadNV12Frame(clip, frame))
+	{
+		clip->shownTexture = clip->nv12Texture;
+		path = UploadPath_NV12;
+	}
+	else
+	{
+		if(ditherFrame(frame, vfile->width, vfile->height)) path = UploadPath_Dither;
+		if(frame == clip->frame) convertVideoClipFrame(clip);
+		else convertFrameTo(clip, frame, clip->yPlane, clip->uPlane, clip->vPlane);
+		updateClipYUV(clip, clip->yPlane, vfile->width, clip->uPlane, clip->uvPitch,
+		              clip->vPlane, clip->uvPitch);
+		clip->shownTexture = clip->texture;
+	}
+	clip->shownQuality = DecodeQuality_Full;
+	uint64 bytes = (path == UploadPath_NV12) ? uploadFrameBytes(clip) : uploadCropBytes(clip);
+	// The conversion is never cropped
+	if(path == UploadPath_Sws || path == UploadPath_Dither) bytes += uploadFrameBytes(clip);
+	countUpload(clip, path, bytes);
+	return path;
+}
+
+#endif
@@ -1,32 +1,49 @@
 #ifndef VIDEO_H
 #define VIDEO_H
 
-// Frame Data
-struct Frame
+#include "framecache.h"
+#include "mappedfile.h"
+#include "pipeline.h"
+#include "threading.h"
+#include "dither.h"
+
+// NOTE: Frame index, a structure of arrays with one entry per frame. Packets (and so the decode
+// order arrays) are stored in the file in decode order, the playhead and everything else in the UI
+// counts frames in display order. "Frame" on its own always means a display index.
+struct FrameIndex
 {
-	int            parentKeyframe = -1;
-	int64          pts = INT_MIN;
-	int64          dts = INT_MIN;
+	// Decode order
+	int64 *pts             = NULL;
+	int64 *dts             = NULL;
+	int32 *parentKeyframe  = NULL; // Decode index of the keyframe decoding has to start from
+	int32 *decodeToDisplay = NULL;
+	int64 *pos             = NULL; // Byte offset of the packet in the file, -1 if not known
+	int32 *size            = NULL; // Packet size in bytes
+	// Display order
+	int64 *displayPts      = NULL; // Ascending, for pts -> frame lookups
+	int32 *displayToDecode = NULL;
+	// One per GOP
+	int32 *keyframes       = NULL; // Display index of every keyframe (decode index while indexing)
+	uint32 capacity        = 0;
 };
 
 struct VideoFile
 {
 	AVFormatContext *formatCtx;
-	AVCodecContext  *codecCtx;
+	AVCodecContext  *codecCtx;      // Playback mode
+	AVCodecContext  *seekCodecCtx;  // Seek mode, see threading.h
+	AVCodecContext  *draftCodecCtx; // Seek mode at draft quality, opened on first use
 	AVCodec         *codec;
 	AVStream        *stream;
-	Frame           *frames;
-	int             *keyframeList;
-	int             *ptsList;
-	int             *ptsListSorted;
+	FrameIndex       index;
+	DecodeThreading  threading;
 	int              streamIndex    = 0;
+	int              maxGopLength   = 0;
 	int              bitrate        = 0;
 	int              arW            = 0;
 	int              arH            = 0;
 	int              width          = 0;
 	int              height         = 0;
-	uint32          _framesListSize = 0;
-	uint32          _ptsListSize    = 0;
 	uint32           nkeyframes     = 0;
 	uint32					 nframes        = 0;
 	uint64           timeBase       = 0;
@@ -34,19 +51,121 @@ struct VideoFile
 	float            avgFramerate   = 0.0f;
 	float            msperframe     = 0.0f;
 	float            arF            = 0.0f;
+	MappedFile       indexFile; // Set when the index arrays point into a loaded sidecar
+	SDL_Thread      *indexThread    = NULL;
+	SDL_atomic_t     nindexed;        // Frames (in decode order) indexed so far
+	SDL_atomic_t     indexDone;       // Set once the whole index can be used
+	SDL_atomic_t     indexAbort;
+	uint32           estimatedFrames = 0; // From the container duration, until the index is done
+	bool             intraOnly      = false; // Every frame is a keyframe, known once the index is done
+	MappedFile       rawFile;         // The video itself, mapped for uncompressed video (rawvideo.h)
+	bool             rawDirect      = false;
+	bool             rawSwapChroma  = false;
 };
 
+// Lets a long decode that runs on behalf of another thread notice that it is no longer wanted:
+// the work is cancelled as soon as *generation moves past value.
+struct CancelToken
+{
+	SDL_atomic_t *generation = NULL;
+	int           value      = 0;
+};
+
+inline bool cancelled(CancelToken cancel)
+{
+	return cancel.generation && SDL_AtomicGet(cancel.generation) != cancel.value;
+}
+
+// Written by whichever thread owns the clip's decoder, only read for the debug output.
+struct SeekStats
+{
+	uint64 seeks          = 0;
+	uint64 packets        = 0; // Packets sent to the decoder while rolling forward to a target
+	uint64 skippedFrames  = 0; // Non-reference frames the decoder discarded on the way
+	uint64 continued      = 0; // Seeks that decoded on from the decoder's position instead
+};
+
+// Ways a frame gets into the clip's texture, see upload.h
+enum UploadPath
+{
+	UploadPath_Direct,  // Decoder planes straight into the YV12 texture
+	UploadPath_NV12,    // Decoder planes straight into the NV12 texture
+	UploadPath_Sws,     // Converted into the clip's planes first
+	UploadPath_Dither,  // High bit depth, dithered into the clip's planes first (dither.h)
+	UploadPath_Planes,  // Packed YUV420P planes (cache, playback queue, seek result, mapped file)
+	UploadPath_Scaled,  // Converted and scaled down to the size it is shown at first
+	UploadPath_Count
+};
+
+// Only written on the main thread, read for the debug output.
+struct UploadStats
+{
+	uint64 frames[UploadPath_Count];
+	uint64 bytes[UploadPath_Count];  // Including the conversion on the sws path
+};
+
+// Scaler contexts kept around per source format and size and target size, see displayScaler()
+#define DISPLAY_SCALER_CONTEXTS 4
+
+struct DisplayScalerEntry
+{
+	SwsContext *ctx       = NULL;
+	int         srcFormat = -1;
+	int         srcWidth  = 0;
+	int         srcHeight = 0;
+	int         width     = 0;
+	int         height    = 0;
+	uint32      lastUse   = 0;
+};
+
+// Frames shown smaller than the video are converted at the size they are shown at and go into a
+// texture of that size (upload.h). Main thread only, except threadSize.
+struct DisplayScale
+{
+	SDL_Renderer      *renderer = NULL;
+	int                wantWidth  = 0; // From videoRect, 0 while the video is shown at 1:1 or larger
+	int                wantHeight = 0;
+	SDL_atomic_t       threadSize;     // wantWidth << 16 | wantHeight, see displayThreadSize()
+	int                width    = 0;   // Size of the texture and planes, 0 if there are none
+	int                height   = 0;
+	SDL_Texture       *texture  = NULL;
+	uint8             *planes[3];
+	DisplayScalerEntry scalers[DISPLAY_SCALER_CONTEXTS];
+	uint32             uses     = 0;
+	SDL_Rect           crop;       // Part of the video full size uploads copy, all of it unless zoomed in
+	SDL_Rect           shownCrop;  // Part of the video in the full size texture (or shown planes)
+};
+
+// Quality tier of a decoded frame. Draft frames come from the draft codec context (see
+// openDecodeContext()) and are never put in the frame cache, the full frame replaces them once the
+// drag on the timeline rests or ends.
+enum DecodeQuality
+{
+	DecodeQuality_Full,
+	DecodeQuality_Draft
+};
+
+// Decode this many times smaller at draft quality, where the decoder supports it (lowres)
+#define DRAFT_LOWRES 2
+
 struct VideoClip
 {
 	VideoFile    *vfile;
 	SDL_Rect      tlRect;
 	SDL_Rect      videoRect;
 	SDL_Texture  *texture;
+	SDL_Texture  *nv12Texture;  // Only for video that decodes to NV12, NULL if the renderer can't
+	SDL_Texture  *shownTexture; // Whichever of the two was uploaded last, this is what gets drawn
 	AVFrame      *frame;
 	SwsContext   *swsCtx;
+	SwsContext   *draftSwsCtx;  // Scales draft frames (smaller with lowres) up to the planes
+	DitherKernels dither;       // Converts 10/12-bit frames instead of swsCtx
 	uint8        *yPlane;  
 	uint8        *uPlane;  
 	uint8        *vPlane;  
+	int64         planesPts;    // Full quality frame in the planes, AV_NOPTS_VALUE if none
+	uint8        *shownPlanes[3]; // Frame on screen when presenting in software (softpresent.h)
+	DisplayScale  display;
 	int32         uvPitch;
 	int           width;
 	int           height;
@@ -55,12 +174,304 @@ struct VideoClip
 	int           beginFrame;
 	int           endFrame;
 	int           number;
+	int           decoderFrame; // Display index of the last frame the decoder produced, -1 if unknown
+	int           reversePrefetchGop; // GOP to decode into the cache once the frame is on screen
+	DecodeMode    decodeMode;   // Which codec context the next seek uses
+	DecodeQuality quality;      // Quality decodeToFrame() decodes at, only the seek thread drafts
+	DecodeQuality shownQuality; // Quality of the frame in the texture
+	bool          indexComplete;
+	CancelToken   cancel;
 	char         *filename;
+	FrameCache    cache;
+	SeekStats     seekStats;
+	UploadStats   uploadStats;
+	DecodePipeline pipe;   // Packets and frames in flight in the clip's decoder
 };
 
-int ptsCompare(const void * a, const void * b)
+#include "indexfile.h"
+#include "upload.h"
+#include "rawvideo.h"
+
+struct DisplayOrderEntry
+{
+	int64 pts;
+	int32 decodeIndex;
+};
+
+// NOTE: Compares instead of subtracting, the difference of two int64 timestamps does not fit in
+// the int qsort wants.
+int displayOrderCompare(const void *a, const void *b)
+{
+	const DisplayOrderEntry *x = (const DisplayOrderEntry *)a;
+	const DisplayOrderEntry *y = (const DisplayOrderEntry *)b;
+	if(x->pts < y->pts) return -1;
+	if(x->pts > y->pts) return 1;
+	return (x->decodeIndex < y->decodeIndex) ? -1 : (x->decodeIndex > y->decodeIndex);
+}
+
+// Allocates the index arrays for the estimated number of frames. This has to happen before the
+// indexing thread starts so the arrays never move while the main thread is reading them.
+void allocateFrameIndex(VideoFile *vfile)
 {
-	return (*(int *)a - *(int *)b);
+	float estimatedFrames = 
+		ceil(((float)vfile->formatCtx->duration / AV_TIME_BASE) * vfile->framerate) + 10;
+	printf("Estimated Frames: %f\n", estimatedFrames);
+	vfile->estimatedFrames = estimatedFrames - 10;
+
+	FrameIndex *index = &vfile->index;
+	index->capacity = estimatedFrames;
+	index->pts = (int64 *)malloc(index->capacity * sizeof(int64));
+	index->dts = (int64 *)malloc(index->capacity * sizeof(int64));
+	index->parentKeyframe = (int32 *)malloc(index->capacity * sizeof(int32));
+	index->pos = (int64 *)malloc(index->capacity * sizeof(int64));
+	index->size = (int32 *)malloc(index->capacity * sizeof(int32));
+	index->keyframes = (int32 *)malloc(index->capacity * sizeof(int32));
+
+	vfile->nkeyframes = 0;
+	vfile->maxGopLength = 0;
+}
+
+// Builds the display order arrays from the pts of every packet and turns the keyframe list into
+// display indices. A keyframe is always displayed before the frames that depend on it, so the
+// keyframe list stays sorted.
+internal void buildDisplayOrder(VideoFile *vfile)
+{
+	FrameIndex *index = &vfile->index;
+	uint32 nframes = vfile->nframes;
+	index->displayPts = (int64 *)malloc(nframes * sizeof(int64));
+	index->displayToDecode = (int32 *)malloc(nframes * sizeof(int32));
+	index->decodeToDisplay = (int32 *)malloc(nframes * sizeof(int32));
+
+	DisplayOrderEntry *entries = (DisplayOrderEntry *)malloc(nframes * sizeof(DisplayOrderEntry));
+	for(uint32 i = 0; i < nframes; ++i)
+	{
+		entries[i].pts = index->pts[i];
+		entries[i].decodeIndex = i;
+	}
+	qsort(entries, nframes, sizeof(DisplayOrderEntry), displayOrderCompare);
+	for(uint32 i = 0; i < nframes; ++i)
+	{
+		index->displayPts[i] = entries[i].pts;
+		index->displayToDecode[i] = entries[i].decodeIndex;
+		index->decodeToDisplay[entries[i].decodeIndex] = i;
+	}
+	free(entries);
+
+	for(uint32 i = 0; i < vfile->nkeyframes; ++i)
+	{
+		index->keyframes[i] = index->decodeToDisplay[index->keyframes[i]];
+	}
+
+	// maxGopLength was counted in decode order. With open GOPs the leading B-frames of the next
+	// keyframe are displayed before it, so a GOP's display range (which is what reverse playback
+	// buffers) can be longer than its packets.
+	for(uint32 i = 0; i < vfile->nkeyframes; ++i)
+	{
+		int end = (i + 1 < vfile->nkeyframes) ? index->keyframes[i + 1] : (int)nframes;
+		if(end - index->keyframes[i] > vfile->maxGopLength)
+		{
+			vfile->maxGopLength = end - index->keyframes[i];
+		}
+	}
+}
+
+// NOTE: This runs on the indexing thread (see startFrameIndexing()). Every packet that has been
+// added to the decode order arrays is published through vfile->nindexed, everything else in the
+// index (the frame count, keyframe list and display order arrays) may only be read by other
+// threads once vfile->indexDone is set.
+void probeForNumberOfFrames(VideoFile *vfile)
+{
+	uint32 nframes = 0;
+	FrameIndex *index = &vfile->index;
+
+	AVFormatContext *formatCtx = NULL;
+	if(avformat_open_input(&formatCtx, vfile->formatCtx->filename, NULL, NULL) != 0)
+	{
+		printf("Could not open file: \"%s\".\n", vfile->formatCtx->filename);
+		exit(-1);
+	}
+
+	AVPacket packet;
+	av_init_packet(&packet);
+
+	int parentKeyframe = -1;
+
+	uint64 start = (uint64)SDL_GetTicks();
+	while(!SDL_AtomicGet(&vfile->indexAbort) && av_read_frame(formatCtx, &packet) >= 0)
+	{
+		if(packet.stream_index == vfile->streamIndex)
+		{
+			assert(nframes < index->capacity);
+			if(packet.flags & AV_PKT_FLAG_KEY)
+			{
+				if(parentKeyframe >= 0 && (int)nframes - parentKeyframe > vfile->maxGopLength)
+				{
+					vfile->maxGopLength = nframes - parentKeyframe;
+				}
+				parentKeyframe = nframes;
+				index->keyframes[vfile->nkeyframes] = nframes;
+				vfile->nkeyframes++;
+			}
+			// Packets before the first keyframe can only be decoded from the start of the file
+			index->parentKeyframe[nframes] = parentKeyframe >= 0 ? parentKeyframe : 0;
+			index->pts[nframes] = packet.pts != AV_NOPTS_VALUE ? packet.pts : packet.dts;
+			index->dts[nframes] = packet.dts;
+			index->pos[nframes] = packet.pos;
+			index->size[nframes] = packet.size;
+			nframes++;
+			SDL_AtomicSet(&vfile->nindexed, nframes);
+		}
+		av_packet_unref(&packet);
+	}
+	uint64 end = (uint64)SDL_GetTicks();
+	uint64 elapsed = end - start;
+	printTiming("probing frames", elapsed);
+
+	avformat_close_input(&formatCtx);
+
+	vfile->nframes = nframes;
+	if(parentKeyframe >= 0 && (int)nframes - parentKeyframe > vfile->maxGopLength)
+	{
+		vfile->maxGopLength = nframes - parentKeyframe;
+	}
+
+	if(vfile->nkeyframes == 0)
+	{
+		// Only happens for broken files, treat the first frame as the keyframe
+		index->keyframes[0] = 0;
+		vfile->nkeyframes = 1;
+		vfile->maxGopLength = nframes;
+	}
+
+	buildDisplayOrder(vfile);
+	vfile->intraOnly = nframes > 0 && vfile->nkeyframes == nframes;
+
+#if 0
+	for(int i = 0; i < nframes; ++i)
+	{
+		
+		int64 pts = index->pts[i];
+		int64 dts = index->dts[i];
+		int pkey = index->parentKeyframe[i];
+
+		printf("FRAME %d: \t PTS: %lld,\t DTS: %lld, \t PKEY: %d\n", 
+		       i + 1, pts, dts, pkey); 
+	}
+	printf("\n");
+#endif
+}
+
+internal int indexVideoFileThread(void *data)
+{
+	VideoFile *vfile = (VideoFile *)data;
+	probeForNumberOfFrames(vfile);
+	if(!SDL_AtomicGet(&vfile->indexAbort))
+	{
+		saveFrameIndex(vfile, vfile->formatCtx->filename);
+		SDL_AtomicSet(&vfile->indexDone, 1);
+	}
+	return 0;
+}
+
+// Indexes the video on a worker thread so the first frame can be shown (and played) right away.
+void startFrameIndexing(VideoFile *vfile)
+{
+	SDL_AtomicSet(&vfile->nindexed, 0);
+	SDL_AtomicSet(&vfile->indexDone, 0);
+	SDL_AtomicSet(&vfile->indexAbort, 0);
+	allocateFrameIndex(vfile);
+	vfile->indexThread = SDL_CreateThread(indexVideoFileThread, "MouseIndexer", vfile);
+}
+
+void stopFrameIndexing(VideoFile *vfile)
+{
+	if(vfile->indexThread)
+	{
+		SDL_AtomicSet(&vfile->indexAbort, 1);
+		SDL_WaitThread(vfile->indexThread, NULL);
+		vfile->indexThread = NULL;
+	}
+}
+
+inline bool frameIndexReady(VideoFile *vfile)
+{
+	return SDL_AtomicGet(&vfile->indexDone) != 0;
+}
+
+// Number of frames (in display order) that can safely be played while the index is still being
+// built. Packets arrive in decode order, so leave room for B-frame reordering.
+#define INDEX_REORDER_MARGIN 16
+inline int indexedFrameCount(VideoFile *vfile)
+{
+	if(frameIndexReady(vfile)) return vfile->nframes;
+	int n = SDL_AtomicGet(&vfile->nindexed) - INDEX_REORDER_MARGIN;
+	return n > 0 ? n : 0;
+}
+
+// NOTE: The lookups below need the complete index (frameIndexReady()).
+
+// O(1): pts of a frame.
+inline int64 framePts(VideoFile *vfile, int frame)
+{
+	return vfile->index.displayPts[frame];
+}
+
+// O(1): dts of a frame's packet.
+inline int64 frameDts(VideoFile *vfile, int frame)
+{
+	return vfile->index.dts[vfile->index.displayToDecode[frame]];
+}
+
+// O(log n): display index of the frame with the given pts, or -1 if no frame has it.
+int frameIndexFromPts(VideoFile *vfile, int64 pts)
+{
+	int64 *displayPts = vfile->index.displayPts;
+	int lo = 0;
+	int hi = (int)vfile->nframes - 1;
+	while(lo <= hi)
+	{
+		int mid = lo + ((hi - lo) / 2);
+		if(displayPts[mid] == pts) return mid;
+		if(displayPts[mid] < pts) lo = mid + 1;
+		else hi = mid - 1;
+	}
+	return -1;
+}
+
+// O(log n): the GOP (index into the keyframe list) the frame belongs to.
+int gopForFrame(VideoFile *vfile, int frame)
+{
+	int32 *keyframes = vfile->index.keyframes;
+	int lo = 0;
+	int hi = (int)vfile->nkeyframes - 1;
+	int gop = 0;
+	while(lo <= hi)
+	{
+		int mid = lo + ((hi - lo) / 2);
+		if(keyframes[mid] <= frame)
+		{
+			gop = mid;
+			lo = mid + 1;
+		}
+		else hi = mid - 1;
+	}
+	return gop;
+}
+
+// Display indices [start, end) of the frames in a GOP.
+inline void gopFrameRange(VideoFile *vfile, int gop, int *start, int *end)
+{
+	*start = vfile->index.keyframes[gop];
+	*end = (gop + 1 < (int)vfile->nkeyframes) ? vfile->index.keyframes[gop + 1] : vfile->nframes;
+}
+
+// Decode indices [first, end) of the packets in a GOP, the first one is its keyframe.
+inline void gopPacketRange(VideoFile *vfile, int gop, int *first, int *end)
+{
+	FrameIndex *index = &vfile->index;
+	*first = index->displayToDecode[index->keyframes[gop]];
+	*end = (gop + 1 < (int)vfile->nkeyframes) ? 
+		index->displayToDecode[index->keyframes[gop + 1]] : vfile->nframes;
 }
 
 // TODO Fix memory leak error when dragging and dropping clips
@@ -69,347 +480,485 @@ int ptsCompare(const void * a, const void * b)
 void freeVideoFile(VideoFile *vfile)
 {
 	printf("Freeing video file: %s\n\n", vfile->formatCtx->filename); // DEBUG
+	stopFrameIndexing(vfile);
+	stopThreadCalibration(&vfile->threading);
 	avcodec_close(vfile->codecCtx);
+	avcodec_free_context(&vfile->codecCtx);
+	avcodec_close(vfile->seekCodecCtx);
+	avcodec_free_context(&vfile->seekCodecCtx);
+	if(vfile->draftCodecCtx)
+	{
+		avcodec_close(vfile->draftCodecCtx);
+		avcodec_free_context(&vfile->draftCodecCtx);
+	}
 	avformat_close_input(&vfile->formatCtx);
 	av_free(vfile->codec);
+	if(vfile->indexFile.data)
+	{
+		unmapFile(&vfile->indexFile);
+	}
+	else
+	{
+		free(vfile->index.pts);
+		free(vfile->index.dts);
+		free(vfile->index.parentKeyframe);
+		free(vfile->index.decodeToDisplay);
+		free(vfile->index.pos);
+		free(vfile->index.size);
+		free(vfile->index.displayPts);
+		free(vfile->index.displayToDecode);
+		free(vfile->index.keyframes);
+	}
+	vfile->index = FrameIndex();
+	closeRawVideo(vfile);
 }
 
 void freeVideoClip(VideoClip *clip)
 {
 	printf("Freeing video clip %d : %s\n", clip->number, clip->vfile->formatCtx->filename); // DEBUG
 	av_free(clip->swsCtx);
+	sws_freeContext(clip->draftSwsCtx);
+	clip->draftSwsCtx = NULL;
 	av_frame_free(&clip->frame);
+	freeDecodePipeline(&clip->pipe);
 	SDL_free(clip->texture);
+	if(clip->nv12Texture) SDL_DestroyTexture(clip->nv12Texture);
+	clip->nv12Texture = NULL;
 	free(clip->yPlane);
 	free(clip->uPlane);
 	free(clip->vPlane);
+	for(int i = 0; i < 3; ++i)
+	{
+		free(clip->shownPlanes[i]);
+		clip->shownPlanes[i] = NULL;
+	}
+	freeDisplayScale(&clip->display);
+	printFrameCacheInfo(clip->cache); // DEBUG
+	printf("Seeks: %llu (%llu without a keyframe seek), %llu packets rolled through, "
+	       "%llu non-reference frames skipped\n", clip->seekStats.seeks, clip->seekStats.continued,
+	       clip->seekStats.packets, clip->seekStats.skippedFrames); // DEBUG
+	printUploadStats(&clip->uploadStats); // DEBUG
+	freeFrameCache(&clip->cache);
 }
 
 void updateVideoClipTexture(VideoClip *clip)
 {
-	AVPicture pict;
-	pict.data[0] = clip->yPlane;
-	pict.data[1] = clip->uPlane;
-	pict.data[2] = clip->vPlane;
-	pict.linesize[0] = clip->vfile->width;
-	pict.linesize[1] = clip->uvPitch;
-	pict.linesize[2] = clip->uvPitch;
-
-	sws_scale(clip->swsCtx, (uint8 const * const *)clip->frame->data, clip->frame->linesize, 
-	          0, clip->vfile->height, pict.data, pict.linesize);
+	uploadDecodedFrame(clip, clip->frame);
+}
 
-	SDL_UpdateYUVTexture(clip->texture, NULL, clip->yPlane, 
-	                     clip->vfile->width, clip->uPlane,
-	                     clip->uvPitch, clip->vPlane, clip->uvPitch);
+inline bool seekCancelled(VideoClip *clip)
+{
+	return cancelled(clip->cancel);
 }
 
-inline void flushPlayEnd(VideoClip *clip, int *currentTime)
+// Puts a full quality frame in the clip's frame cache so it can be shown again without decoding.
+// A direct frame is copied straight from its planes, anything else has to be the clip's frame
+// and is converted into the clip's planes first (see uploadDecodedFrame()).
+void cacheDecodedFrame(VideoClip *clip, AVFrame *frame, int index, int playhead)
 {
-	// printf("Flushing with index.\n"); // DEBUG
-	if(clip->vfile->codec->capabilities & AV_CODEC_CAP_DELAY)
+	if(directFrame(clip->vfile, frame))
 	{
-		AVPacket packet;
-		av_init_packet(&packet);
-		packet.data = NULL;
-		packet.size = 0;
-		int gotFrame = 1;
-		int result = 0;
-		while((result = avcodec_decode_video2(clip->vfile->codecCtx, clip->frame,
-		                                      &gotFrame, &packet)) >= 0 && gotFrame);
-		{
-			if(gotFrame)
-			{
-				updateVideoClipTexture(clip);
-				++currentTime;
-			}
-		}
-		av_packet_unref(&packet);
+		frameCacheInsertStrided(&clip->cache, index, playhead, frame->data, frame->linesize);
+	}
+	else
+	{
+		convertVideoClipFrame(clip);
+		frameCacheInsert(&clip->cache, index, playhead, clip->yPlane, clip->uPlane, clip->vPlane);
 	}
 }
 
-inline void flushClipEnd(VideoClip *clip)
+// Keep the frame the clip's decoder just produced.
+inline void cacheVideoClipFrame(VideoClip *clip, int index)
 {
-	// printf("Flushing clip only.\n"); // DEBUG
-	if(clip->vfile->codec->capabilities & AV_CODEC_CAP_DELAY)
+	clip->decoderFrame = index;
+	cacheDecodedFrame(clip, clip->frame, index, index);
+}
+
+inline void uploadCachedFrame(VideoClip *clip, CachedFrame *cached)
+{
+	uploadPlanes(clip, cached->yPlane, cached->uPlane, cached->vPlane);
+}
+
+inline AVCodecContext *decodeContext(VideoFile *vfile, DecodeMode mode)
+{
+	return (mode == DecodeMode_Seek) ? vfile->seekCodecCtx : vfile->codecCtx;
+}
+
+// A draft context skips the deblocking filter (and the IDCT of B-frames), allows the codec's
+// non-spec-compliant speedups and decodes at a lower resolution if the decoder supports lowres.
+internal AVCodecContext *openDecodeContext(VideoFile *vfile, ThreadPolicy policy, bool draft)
+{
+	AVCodecContext *codecCtx = avcodec_alloc_context3(vfile->codec);
+	avcodec_copy_context(codecCtx, vfile->stream->codec);
+	// Frames are handed out of the decode pipeline by reference
+	codecCtx->refcounted_frames = 1;
+	applyThreadPolicy(codecCtx, policy);
+	if(draft)
 	{
-		AVPacket packet;
-		av_init_packet(&packet);
-		packet.data = NULL;
-		packet.size = 0;
-		int gotFrame = 0;
-		int result = 0;
-		while((result = avcodec_decode_video2(clip->vfile->codecCtx, 
-		                                      clip->frame, &gotFrame, &packet)) >= 0 && gotFrame)
-		{
-			if(gotFrame)
-			{
-				updateVideoClipTexture(clip);
-			}
-		}
-		av_packet_unref(&packet);
+		codecCtx->skip_loop_filter = AVDISCARD_ALL;
+		codecCtx->skip_idct = AVDISCARD_BIDIR;
+		codecCtx->flags2 |= AV_CODEC_FLAG2_FAST;
+		codecCtx->lowres = (vfile->codec->max_lowres < DRAFT_LOWRES) ?
+			vfile->codec->max_lowres : DRAFT_LOWRES;
 	}
+	avcodec_open2(codecCtx, vfile->codec, NULL);
+	return codecCtx;
 }
 
-inline int decodeSingleFrame(VideoClip *clip)
+// Opens the mode's codec context again with the current policy. Only the thread that owns the
+// clip's decoder may do this, and only while the context is not in the clip's pipeline.
+void reopenDecodeContext(VideoFile *vfile, DecodeMode mode)
 {
-	AVPacket packet;
-	av_init_packet(&packet);
-	int gotFrame = 0;
-	bool done = false;
-	int result = 0;
-	do
+	AVCodecContext **codecCtx = (mode == DecodeMode_Seek) ? &vfile->seekCodecCtx : &vfile->codecCtx;
+	if(*codecCtx)
 	{
-		if(av_read_frame(clip->vfile->formatCtx, &packet) >= 0)
-		{
-			if(packet.stream_index == clip->vfile->streamIndex)
-			{
-				result = avcodec_decode_video2(clip->vfile->codecCtx, clip->frame, &gotFrame, &packet);
-			}
-		}
-		else
-		{
-			gotFrame = -1;
-		}
-	} while(!gotFrame);
-	av_packet_unref(&packet);
-	return result;
+		avcodec_close(*codecCtx);
+		avcodec_free_context(codecCtx);
+	}
+	ThreadPolicy policy = vfile->threading.policy[mode];
+	*codecCtx = openDecodeContext(vfile, policy, false);
+	vfile->threading.opened[mode] = policy;
+	printThreadPolicy("Opened", mode, policy); // DEBUG
+
+	// The draft context follows the seek policy, it is opened again the next time it is used
+	if(mode == DecodeMode_Seek && vfile->draftCodecCtx)
+	{
+		avcodec_close(vfile->draftCodecCtx);
+		avcodec_free_context(&vfile->draftCodecCtx);
+	}
 }
 
-inline int decodeSingleFrameNoCapDelay(VideoClip *clip)
+inline bool draftPipeline(VideoClip *clip)
 {
-	AVPacket packet;
-	av_init_packet(&packet);
-	int gotFrame = 0;
-	bool done = false;
-	int result = 0;
-	do
+	return clip->vfile->draftCodecCtx && clip->pipe.codecCtx == clip->vfile->draftCodecCtx;
+}
+
+// Puts the codec context of the given mode (the draft context for seeks at draft quality) into the
+// clip's pipeline, reopening it first when the calibration picked a different policy. Anything in
+// flight is dropped if the context changes, so call this right before the pipeline is seeked anyway.
+void useDecodeMode(VideoClip *clip, DecodeMode mode)
+{
+	VideoFile *vfile = clip->vfile;
+	DecodePipeline *pipe = &clip->pipe;
+	bool draft = mode == DecodeMode_Seek && clip->quality == DecodeQuality_Draft;
+	bool stale = threadPolicyStale(&vfile->threading, mode);
+	AVCodecContext *wanted = draft ? vfile->draftCodecCtx : decodeContext(vfile, mode);
+	if(!stale && wanted && pipe->codecCtx == wanted) return;
+
+	flushDecodePipeline(pipe);
+	if(stale) reopenDecodeContext(vfile, mode);
+	if(draft && !vfile->draftCodecCtx)
 	{
-		if(av_read_frame(clip->vfile->formatCtx, &packet) >= 0)
-		{
-			if(packet.stream_index == clip->vfile->streamIndex)
-			{
-				result = avcodec_decode_video2(clip->vfile->codecCtx, clip->frame, &gotFrame, &packet);
-				done = true;
-			}
-		}
-	} while(!done);
-	av_packet_unref(&packet);
-	return result;
+		vfile->draftCodecCtx = openDecodeContext(vfile, vfile->threading.opened[DecodeMode_Seek], true);
+	}
+	pipe->codecCtx = draft ? vfile->draftCodecCtx : decodeContext(vfile, mode);
+	clip->decoderFrame = -1;
 }
 
-inline int decodeSingleFrameCapDelay(VideoClip *clip)
+// Decodes the next frame (in display order) into clip->frame. Returns 0 once the decoder has given
+// out every frame of the file.
+inline int decodeSingleFrame(VideoClip *clip)
 {
-	AVPacket packet;
-	av_init_packet(&packet);
-	int gotFrame = 0;
-	bool done = false;
-	int result = 0;
-	do
+	return decodeNextFrame(&clip->pipe, clip->frame) ? 1 : 0;
+}
+
+// Decodes by estimating the wanted frame's timestamp from the frame rate, used while the frame
+// index is still being built. This is exact for constant frame rate video only, so the frame is
+// not put in the frame cache.
+bool decodeToFrameByTimestamp(VideoClip *clip, int wantedFrame)
+{
+	VideoFile *vfile = clip->vfile;
+	AVRational tb = vfile->stream->time_base;
+	AVRational frameDuration = av_inv_q(vfile->stream->avg_frame_rate);
+	int64 startTime = vfile->stream->start_time != AV_NOPTS_VALUE ? vfile->stream->start_time : 0;
+	int64 wantedPts = startTime + av_rescale_q(wantedFrame, frameDuration, tb);
+	int64 halfFrame = av_rescale_q(1, frameDuration, tb) / 2;
+
+	// Packets can't be counted without the index
+	useDecodeMode(clip, clip->decodeMode);
+	if(!seekDecodePipeline(&clip->pipe, -1, wantedPts))
+	{
+		printf("Timestamp seek failed.\n\n");
+		return false;
+	}
+
+	bool found = false;
+	while(!found && decodeNextFrame(&clip->pipe, clip->frame))
 	{
-		if(av_read_frame(clip->vfile->formatCtx, &packet) >= 0)
+		if(seekCancelled(clip))
 		{
-			if(packet.stream_index == clip->vfile->streamIndex)
-			{
-				result = avcodec_decode_video2(clip->vfile->codecCtx, clip->frame, &gotFrame, &packet);
-				done = true;
-			}
+			clip->decoderFrame = -1;
+			return false;
 		}
-	} while(!done);
-	if(clip->vfile->codec->capabilities & AV_CODEC_CAP_DELAY)
+		found = av_frame_get_best_effort_timestamp(clip->frame) >= wantedPts - halfFrame;
+	}
+
+	if(!found)
 	{
-		packet.data = NULL;
-		packet.size = 0;
-		avcodec_decode_video2(clip->vfile->codecCtx, clip->frame, &gotFrame, &packet);
+		// The file ended before the wanted timestamp, clip->frame is some earlier frame
+		printf("Frame %d did not come out of the decoder.\n\n", wantedFrame);
+		clip->decoderFrame = -1;
+		return false;
 	}
-	av_packet_unref(&packet);
-	return result;
+	clip->decoderFrame = wantedFrame;
+	return true;
 }
 
+// A keyframe seek (demuxer seek plus decoder flush) costs about as much as decoding this many
+// packets, see decodeToFrame().
+#define SEEK_OVERHEAD_PACKETS 2
+
 // WARNING: When you call this function MAKE ABSOLUTELY SURE THE WANTED FRAME IS SANITIZED
 // This function will make no attempt to make sure the value is able to be seeked to in the
 // interest of speed. This is an _incredibly_ slow function in it's own right.
-bool seekToAnyFrame(VideoClip *clip, int wantedFrame)
+// The wanted frame is left in clip->frame (and put in the frame cache at full quality), the texture
+// is not touched so this can run on any thread that owns the clip's decoder.
+// NOTE: Seek planning. Decoding can either start over at the parent keyframe of the wanted frame
+// or go on from wherever the decoder is (clip->pipe.nextPacket), as long as the wanted frame has
+// not come out of the decoder yet. The index tells how many packets each plan has to push through
+// the decoder and the cheaper one is taken, so stepping a few frames forward never goes back to the
+// keyframe. Decoding stops as soon as the frame with the wanted pts comes out, the frames after it
+// stay in flight in the pipeline for the next step or for playback.
+// None of the frames before the wanted packet are shown, so the ones nothing else references
+// (most B-frames) are discarded by the decoder instead of being decoded (skip_frame).
+// For intra-only video every packet is its own parent keyframe, so this seeks straight to the
+// wanted packet unless it is right in front of the decoder.
+bool decodeToFrame(VideoClip *clip, int wantedFrame)
 {
-	int flags = 0;
-	if(wantedFrame < Global_seekIndex) flags = AVSEEK_FLAG_BACKWARD;
-	int pkeyf = clip->vfile->frames[wantedFrame].parentKeyframe;
-
-	avcodec_flush_buffers(clip->vfile->codecCtx);
+	if(!frameIndexReady(clip->vfile)) return decodeToFrameByTimestamp(clip, wantedFrame);
+
+	VideoFile *vfile = clip->vfile;
+	FrameIndex *index = &vfile->index;
+	int wantedPacket = index->displayToDecode[wantedFrame];
+	int keyPacket = index->parentKeyframe[wantedPacket];
+	int64 wantedPts = index->displayPts[wantedFrame];
+
+	DecodePipeline *pipe = &clip->pipe;
+	int seekCost = (wantedPacket - keyPacket) + 1 + SEEK_OVERHEAD_PACKETS;
+	int continueCost = -1;
+	bool draft = clip->quality == DecodeQuality_Draft;
+	if(pipe->nextPacket >= 0 && clip->decoderFrame >= 0 && wantedFrame > clip->decoderFrame &&
+	   draftPipeline(clip) == draft)
+	{
+		continueCost = wantedPacket - pipe->nextPacket + 1;
+		if(continueCost < 0) continueCost = 0; // Already sent, just held back by the decoder
+	}
+	bool continuing = continueCost >= 0 && continueCost <= seekCost;
 
-	// If the wanted frame is the first frame in the video, then it is a keyframe and we just need
-	// to seek to it
-	if(wantedFrame == 0)
+	if(!continuing)
 	{
-		int64 pkeyfdts = clip->vfile->frames[0].dts;
-		if(av_seek_frame(clip->vfile->formatCtx, clip->vfile->streamIndex, pkeyfdts, flags) >= 0)
+		useDecodeMode(clip, clip->decodeMode);
+		clip->decoderFrame = -1;
+		if(!seekDecodePipeline(pipe, keyPacket, index->dts[keyPacket]))
 		{
-			// printf("Seek to frame 0 successfull.\n");
-			decodeSingleFrameCapDelay(clip);
-			updateVideoClipTexture(clip);
-			return true;
+			printf("Parent keyframe seek failed.\n\n");
+			return false;
 		}
-		else
+	}
+	int startPacket = pipe->nextPacket;
+	uint64 packetsSent = pipe->packetsSent;
+
+	// The wanted frame's own packet and everything after it is decoded no matter what
+	pipe->skipUntil = wantedPacket;
+	bool found = false;
+	bool passed = false; // A later frame came out, the wanted one was lost
+	int framesBefore = 0; // Frames before the wanted one that came out of the decoder
+	while(!found && !passed && decodeNextFrame(pipe, clip->frame))
+	{
+		if(seekCancelled(clip))
 		{
-			printf("Seeking to frame 0 failed!\n");
+			pipe->skipUntil = -1;
+			clip->decoderFrame = -1;
+			pipe->nextPacket = -1;
 			return false;
 		}
+		int64 pts = av_frame_get_best_effort_timestamp(clip->frame);
+		found = pts == wantedPts;
+		passed = pts > wantedPts;
+		if(pts < wantedPts) ++framesBefore;
+	}
+	pipe->skipUntil = -1;
+	clip->seekStats.packets += pipe->packetsSent - packetsSent;
+
+	if(passed && continuing)
+	{
+		// Only happens when the frame was discarded as a non-reference frame by an earlier seek
+		pipe->nextPacket = -1;
+		return decodeToFrame(clip, wantedFrame);
+	}
+
+	if(!found)
+	{
+		printf("Frame %d did not come out of the decoder.\n\n", wantedFrame);
+		clip->decoderFrame = -1;
+		pipe->nextPacket = -1;
+		return false;
 	}
 
-	// If pkeyf == -1 then this frame is itself a keyframe, so it's parent keyframe does not
-	// need to be calculated, it can be seeked to and decoded right away.
-	if(pkeyf == -1)
+	if(continuing)
 	{
-		int64 dts = clip->vfile->frames[wantedFrame].dts; 
-		if(av_seek_frame(clip->vfile->formatCtx, clip->vfile->streamIndex, dts, flags) >= 0)
+		clip->seekStats.continued++;
+	}
+	else
+	{
+		// Frames come out in display order, so every packet sent that is displayed before the
+		// wanted frame either came out before it or was discarded.
+		int displayedBefore = 0;
+		for(int i = startPacket; i < wantedPacket; ++i)
 		{
-			decodeSingleFrameCapDelay(clip);
-			updateVideoClipTexture(clip);
-			return true;
+			if(index->decodeToDisplay[i] < wantedFrame) ++displayedBefore;
 		}
-		else
+		if(displayedBefore > framesBefore)
 		{
-			printf("Keyframe seek failed.\n\n");
-			return false;
+			clip->seekStats.skippedFrames += displayedBefore - framesBefore;
 		}
 	}
-	else
+	clip->seekStats.seeks++;
+
+	if(draft)
+	{
+		clip->decoderFrame = wantedFrame;
+		return true;
+	}
+	cacheVideoClipFrame(clip, wantedFrame);
+	return true;
+}
+
+// Decodes the wanted frame and shows it, see decodeToFrame().
+bool seekToAnyFrame(VideoClip *clip, int wantedFrame)
+{
+	if(!decodeToFrame(clip, wantedFrame)) return false;
+	updateVideoClipTexture(clip);
+	return true;
+}
+
+// Same as seekToAnyFrame() but first uploads uncompressed frames straight from the file (see
+// rawvideo.h) and looks in the clip's frame cache, in which case showing the frame is only a
+// texture upload. NOTE: On a cache hit the decoder is NOT moved, check
+// clip->decoderFrame before continuing to decode from the decoder's position.
+bool seekToAnyFrameCached(VideoClip *clip, int wantedFrame)
+{
+	if(uploadRawFrame(clip, wantedFrame)) return true;
+	lockFrameCache(&clip->cache);
+	CachedFrame *cached = frameCacheLookup(&clip->cache, wantedFrame);
+	if(cached) uploadCachedFrame(clip, cached);
+	unlockFrameCache(&clip->cache);
+	if(cached) return true;
+	return seekToAnyFrame(clip, wantedFrame);
+}
+
+// Forward stepping: when the decoder sits on the frame right before the wanted one (decodeToFrame()
+// and playback leave it warm) the next display order frame is just pulled out of it, there is no
+// flush and no seek. Everything else (cold decoder, the pulled frame is not the wanted one) goes
+// through the seek planner.
+bool stepForwardToFrame(VideoClip *clip, int wantedFrame)
+{
+	if(uploadRawFrame(clip, wantedFrame)) return true;
+	lockFrameCache(&clip->cache);
+	CachedFrame *cached = frameCacheLookup(&clip->cache, wantedFrame);
+	if(cached) uploadCachedFrame(clip, cached);
+	unlockFrameCache(&clip->cache);
+	if(cached) return true;
+
+	VideoFile *vfile = clip->vfile;
+	if(frameIndexReady(vfile) && clip->pipe.nextPacket >= 0 && clip->decoderFrame == wantedFrame - 1 &&
+	   !draftPipeline(clip))
 	{
-		// Otherwise, the frame is NOT a keyframe and we need to seek to it's parent keyframe
-		// and decode from to the parent keyframe and up to the frame we want
-		int64 pkeyfdts = clip->vfile->frames[pkeyf].dts;
-		flags = AVSEEK_FLAG_BACKWARD; // We MUST set this to backwards. The pkeyf is always behind!
-		// Try to seek to the parent keyframe
-		if(av_seek_frame(clip->vfile->formatCtx, clip->vfile->streamIndex, pkeyfdts, flags) >= 0)
+		if(decodeNextFrame(&clip->pipe, clip->frame))
 		{
-			int wantedPts = clip->vfile->ptsListSorted[wantedFrame];
-			int currentPts = clip->vfile->frames[pkeyf].pts;
-			int count = (wantedFrame - pkeyf) + 10;
-			int i = 0;
-			while((wantedPts != currentPts) && (i <= count))
-			{
-				// Decode all the frames a quickly as possible (without the cap delay flush)
-				decodeSingleFrameNoCapDelay(clip);
-				++i;
-				currentPts = clip->vfile->frames[pkeyf + i].pts;
-			}
-			// 
-			if(i >= count)
+			int64 pts = av_frame_get_best_effort_timestamp(clip->frame);
+			if(pts == framePts(vfile, wantedFrame))
 			{
-				printf("Something went horribly wrong: iterator is >= count.\n\n");
+				cacheVideoClipFrame(clip, wantedFrame);
+				updateVideoClipTexture(clip);
+				return true;
 			}
-			// Quickly flush the buffer
-			flushClipEnd(clip);
-			// Finally decode the last frame (with the cap delay), which is the frame we actually want!!
-			decodeSingleFrameCapDelay(clip);
-			updateVideoClipTexture(clip);
-			return true;
+			clip->decoderFrame = frameIndexFromPts(vfile, pts);
 		}
 		else
 		{
-			printf("Parent keyframe seek failed.\n\n");
-			return false;
+			clip->pipe.nextPacket = -1;
 		}
 	}
-
-	return 1;
+	return seekToAnyFrame(clip, wantedFrame);
 }
 
-void probeForNumberOfFrames(VideoFile *vfile)
+// Decodes every frame of a GOP in one pass and puts all of them in the clip's frame cache.
+// NOTE: Frames come out in display order, so the GOP is done once its last frame came out. The
+// decoder is left warm on that frame (the packets of the next GOP it needed are in flight), a
+// forward step or playback from there just goes on.
+bool decodeGopIntoCache(VideoClip *clip, int gop, int playhead)
 {
-	float estimatedFrames = 
-		ceil(((float)vfile->formatCtx->duration / AV_TIME_BASE) * vfile->framerate) + 10;
-	printf("Estimated Frames: %f\n", estimatedFrames);
-	vfile->_framesListSize = estimatedFrames;
-	vfile->frames = (Frame *)malloc(estimatedFrames * sizeof(Frame));
-
-	vfile->_ptsListSize = estimatedFrames;
-	vfile->ptsList = (int *)malloc(estimatedFrames * sizeof(int));
-
-	vfile->keyframeList = (int *)malloc(estimatedFrames * sizeof(int));
-
-	uint32 nframes = 0;
-
-	AVFormatContext *formatCtx = NULL;
-	if(avformat_open_input(&formatCtx, vfile->formatCtx->filename, NULL, NULL) != 0)
+	VideoFile *vfile = clip->vfile;
+	int first, end, start;
+	gopPacketRange(vfile, gop, &first, &end);
+	gopFrameRange(vfile, gop, &start, &end);
+	int lastFrame = end - 1;
+
+	useDecodeMode(clip, clip->decodeMode);
+	clip->decoderFrame = -1;
+	if(!seekDecodePipeline(&clip->pipe, first, vfile->index.dts[first]))
 	{
-		printf("Could not open file: \"%s\".\n", vfile->formatCtx->filename);
-		exit(-1);
+		printf("GOP seek failed.\n\n");
+		return false;
 	}
 
-	AVCodecContext *codecCtxOrig = vfile->stream->codec;
-	AVCodec *codec = avcodec_find_decoder(codecCtxOrig->codec_id);
-
-	AVCodecContext *codecCtx	= avcodec_alloc_context3(codec);
-	avcodec_copy_context(codecCtx, codecCtxOrig);
-
-	avcodec_open2(codecCtx, codec, NULL);
-
-	AVFrame *frame = av_frame_alloc();
-
-	AVPacket packet;
-	av_init_packet(&packet);
-
-	int gotFrame = 0;
-	int ret = 0;
-	int parentKeyframe = -2;
-
-	uint64 start = (uint64)SDL_GetTicks();
-	while(av_read_frame(formatCtx, &packet) >= 0)
+	int index = -1;
+	while(index < lastFrame && decodeNextFrame(&clip->pipe, clip->frame))
 	{
-		if(packet.stream_index == vfile->streamIndex)
+		if(seekCancelled(clip))
 		{
-			vfile->frames[nframes].parentKeyframe = parentKeyframe;
-			if(packet.flags & AV_PKT_FLAG_KEY)
-			{
-				vfile->frames[nframes].parentKeyframe = -1;
-				parentKeyframe = nframes;
-				vfile->keyframeList[vfile->nkeyframes] = nframes;
-				vfile->nkeyframes++;
-			}
-			vfile->frames[nframes].pts = packet.pts;
-			vfile->frames[nframes].dts = packet.dts;
-			vfile->ptsList[nframes] = packet.pts;
-			nframes++;
-			assert(nframes <= estimatedFrames);		
+			clip->pipe.nextPacket = -1;
+			return false;
 		}
-		av_packet_unref(&packet);
+		int frame = frameIndexFromPts(vfile, av_frame_get_best_effort_timestamp(clip->frame));
+		// Leading frames of an open GOP are missing their references in the previous GOP
+		if(frame < start) continue;
+		index = frame;
+		cacheDecodedFrame(clip, clip->frame, index, playhead);
 	}
-	uint64 end = (uint64)SDL_GetTicks();
-	uint64 elapsed = end - start;
-	printTiming("probing frames", elapsed);
-
-	av_frame_free(&frame);
-	avcodec_flush_buffers(codecCtx);
-	avformat_close_input(&formatCtx);
-	avcodec_close(codecCtx);
-	avcodec_close(codecCtxOrig);
-
-	vfile->nframes = nframes;
+	clip->decoderFrame = index;
+	return true;
+}
 
-	// TODO: pts list qsort
+// Reverse stepping: the first step back into a GOP decodes the whole GOP into the frame cache
+// once, every step after that is served from the cache. Once the playhead is inside a GOP whose
+// previous GOP is not buffered, that GOP is scheduled to be decoded after the frame is presented
+// (see clip->reversePrefetchGop) so the buffer never runs out.
+bool stepBackToFrame(VideoClip *clip, int wantedFrame)
+{
+	VideoFile *vfile = clip->vfile;
+	if(!frameIndexReady(vfile)) return seekToAnyFrame(clip, wantedFrame);
+	// Every GOP is a single frame, there is nothing to buffer
+	if(vfile->intraOnly) return seekToAnyFrameCached(clip, wantedFrame);
 
-	vfile->ptsListSorted = (int *)malloc(vfile->_ptsListSize * sizeof(int));
+	int gop = gopForFrame(vfile, wantedFrame);
 
-	for(int i = 0; i < nframes; ++i)
+	if(!frameCacheContains(&clip->cache, wantedFrame))
 	{
-		vfile->ptsListSorted[i] = vfile->ptsList[i];
+		decodeGopIntoCache(clip, gop, wantedFrame);
 	}
 
-	qsort(vfile->ptsListSorted, nframes, sizeof(int), ptsCompare);
-
-#if 0
-	for(int i = 0; i < nframes; ++i)
+	if(gop > 0 && !frameCacheContains(&clip->cache, vfile->index.keyframes[gop] - 1))
 	{
-		
-		int64 pts = vfile->frames[i].pts;
-		int64 dts = vfile->frames[i].dts;
-		int pkey = vfile->frames[i].parentKeyframe;
-
-		printf("FRAME %d: \t PTS: %d,\t DTS: %d, \t PKEY: %d\n", 
-		       i + 1, pts, dts, pkey); 
+		clip->reversePrefetchGop = gop - 1;
 	}
-	printf("\n");
-#endif
+
+	lockFrameCache(&clip->cache);
+	CachedFrame *cached = frameCacheLookup(&clip->cache, wantedFrame);
+	if(cached) uploadCachedFrame(clip, cached);
+	unlockFrameCache(&clip->cache);
+	if(cached) return true;
+	return seekToAnyFrame(clip, wantedFrame);
+}
+
+// Decodes the GOP scheduled by stepBackToFrame(), call this after the current frame is presented.
+void prefetchReverseGop(VideoClip *clip, int playhead)
+{
+	if(clip->reversePrefetchGop < 0) return;
+	int gop = clip->reversePrefetchGop;
+	clip->reversePrefetchGop = -1;
+	decodeGopIntoCache(clip, gop, playhead);
 }
 
 void createVideoClip(VideoClip *clip, VideoFile *vfile, SDL_Renderer *renderer, int number)
@@ -454,13 +1003,53 @@ void createVideoClip(VideoClip *clip, VideoFile *vfile, SDL_Renderer *renderer,
 	                              NULL,
 	                              NULL);
 
+	clip->dither = selectDitherKernels();
+	bool chroma422;
+	if(ditherBits(clip->vfile->codecCtx->pix_fmt, &chroma422))
+	{
+		printf("High bit depth video: dithered to 8 bits with the %s kernels.\n\n",
+		       clip->dither.name); // DEBUG
+	}
+
 	clip->texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_YV12, SDL_TEXTUREACCESS_STREAMING,
 	                                  clip->vfile->width, clip->vfile->height);
+	clip->nv12Texture = NULL;
+	if(clip->vfile->codecCtx->pix_fmt == AV_PIX_FMT_NV12 && evenSize(clip->vfile))
+	{
+		clip->nv12Texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_NV12,
+		                                      SDL_TEXTUREACCESS_STREAMING,
+		                                      clip->vfile->width, clip->vfile->height);
+	}
+	clip->shownTexture = clip->texture;
+	clip->shownPlanes[0] = clip->shownPlanes[1] = clip->shownPlanes[2] = NULL;
+	clip->display = DisplayScale();
+	clip->display.renderer = renderer;
+	clip->display.crop = clip->videoRect;
+	clip->display.shownCrop = clip->videoRect;
+	clip->planesPts = AV_NOPTS_VALUE;
+	clip->uploadStats = UploadStats();
 
 	clip->beginFrame = 0;
-	clip->endFrame = clip->vfile->nframes - 1;
-
-	decodeSingleFrameCapDelay(clip);
+	clip->endFrame = clip->vfile->estimatedFrames - 1;
+	clip->indexComplete = false;
+
+	// Reverse stepping buffers the current and the previous GOP, so make room for both
+	// (the megabyte bound still applies).
+	int cacheFrames = FRAMECACHE_DEFAULT_FRAMES;
+	if(2 * clip->vfile->maxGopLength > cacheFrames) cacheFrames = 2 * clip->vfile->maxGopLength;
+	createFrameCache(&clip->cache, clip->vfile->width, clip->vfile->height,
+	                 cacheFrames, FRAMECACHE_DEFAULT_MEGABYTES);
+	clip->reversePrefetchGop = -1;
+	clip->seekStats = SeekStats();
+	clip->decodeMode = DecodeMode_Seek;
+	clip->quality = DecodeQuality_Full;
+	clip->draftSwsCtx = NULL;
+	createDecodePipeline(&clip->pipe, clip->vfile->formatCtx,
+	                     decodeContext(clip->vfile, clip->decodeMode), clip->vfile->streamIndex);
+	clip->pipe.nextPacket = 0; // The demuxer is still at the first packet
+
+	decodeSingleFrame(clip);
+	cacheVideoClipFrame(clip, 0);
 	updateVideoClipTexture(clip);
 
 	clip->number = number;
@@ -468,6 +1057,28 @@ void createVideoClip(VideoClip *clip, VideoFile *vfile, SDL_Renderer *renderer,
 	clip->filename = av_strdup(clip->vfile->formatCtx->filename);
 }
 
+// Picks up the finished frame index once the indexing thread is done. Returns true when the clip
+// changed (so the timeline has to be laid out again).
+bool updateVideoClipIndex(VideoClip *clip)
+{
+	if(clip->indexComplete || !frameIndexReady(clip->vfile)) return false;
+
+	clip->indexComplete = true;
+	clip->endFrame = clip->vfile->nframes - 1;
+	openRawVideo(clip->vfile);
+
+	// The GOP length is only known now, make sure reverse stepping can buffer two GOPs
+	if(2 * clip->vfile->maxGopLength > (int)clip->cache.nslots)
+	{
+		freeFrameCache(&clip->cache);
+		createFrameCache(&clip->cache, clip->vfile->width, clip->vfile->height,
+		                 2 * clip->vfile->maxGopLength, FRAMECACHE_DEFAULT_MEGABYTES);
+	}
+	printf("Frame index finished: %d frames, %d keyframes.\n\n",
+	       clip->vfile->nframes, clip->vfile->nkeyframes);
+	return true;
+}
+
 void loadVideoFile(VideoFile *vfile, SDL_Renderer *renderer, const char *filename)
 {
 	vfile->formatCtx = NULL;
@@ -505,7 +1116,13 @@ void loadVideoFile(VideoFile *vfile, SDL_Renderer *renderer, const char *filenam
 
 	avcodec_close(codecCtxOrig);
 
+	// Opened with the default policies, see setupDecodeThreading() for the calibrated ones
+	createDecodeThreading(&vfile->threading);
+	applyThreadPolicy(vfile->codecCtx, vfile->threading.policy[DecodeMode_Playback]);
+	vfile->codecCtx->refcounted_frames = 1;
 	avcodec_open2(vfile->codecCtx, vfile->codec, NULL);
+	vfile->seekCodecCtx = openDecodeContext(vfile, vfile->threading.policy[DecodeMode_Seek], false);
+	vfile->draftCodecCtx = NULL;
 
 	AVRational tb = vfile->stream->time_base;
 	vfile->timeBase = ((int64)tb.num * AV_TIME_BASE) / (int64)tb.den;
@@ -523,7 +1140,19 @@ void loadVideoFile(VideoFile *vfile, SDL_Renderer *renderer, const char *filenam
 	av_reduce(&vfile->arW, &vfile->arH, vfile->codecCtx->width, vfile->codecCtx->height, 1024);
 	vfile->arF = (float)vfile->arW / (float)vfile->arH;
 
-	probeForNumberOfFrames(vfile);
+	if(loadFrameIndex(vfile, filename))
+	{
+		vfile->estimatedFrames = vfile->nframes;
+		vfile->intraOnly = vfile->nframes > 0 && vfile->nkeyframes == vfile->nframes;
+		SDL_AtomicSet(&vfile->nindexed, vfile->nframes);
+		SDL_AtomicSet(&vfile->indexDone, 1);
+	}
+	else
+	{
+		vfile->nframes = 0;
+		vfile->intraOnly = false;
+		startFrameIndexing(vfile);
+	}
 
 	avcodec_close(codecCtxOrig);
 }
@@ -564,6 +1193,8 @@ void printVideoFileInfo(VideoFile vfile)
 	printf("Width/Height: %dx%d\n", vfile.width, vfile.height);
 	printf("Aspect Ratio: (%.2f), [%d:%d]\n", vfile.arF, vfile.arW, vfile.arH);
 	printf("Keyframes: %d\n", vfile.nkeyframes);
+	printf("Longest GOP: %d frames\n", vfile.maxGopLength);
+	if(vfile.intraOnly) printf("Intra-only: every frame is a keyframe\n");
 	#if 0
 	printf("\t[ ");
 	for(int i = 0, j = 0; i < vfile.nkeyframes - 1; ++i, ++j)
@@ -573,9 +1204,9 @@ void printVideoFileInfo(VideoFile vfile)
 			printf("\n\t");
 			j = 0;
 		}
-		printf("%d, ", vfile.keyframeList[i]);
+		printf("%d, ", vfile.index.keyframes[i]);
 	}
-	printf("%d ]\n", vfile.keyframeList[vfile.nkeyframes - 1]);
+	printf("%d ]\n", vfile.index.keyframes[vfile.nkeyframes - 1]);
 	printf("PTS List:\n");
 	printf("\t[");
 	for(int i = 0, j = 0; i < vfile.ntotalFrames - 1; ++i, ++j)
@@ -585,9 +1216,9 @@ void printVideoFileInfo(VideoFile vfile)
 			printf("\n\t");
 			j = 0;
 		}
-		printf("%d: %d, ", i, vfile.ptsList[i]);
+		printf("%d: %d, ", i, vfile.index.pts[i]);
 	}
-	printf("%d: %d ]\n", vfile.ntotalFrames - 1, vfile.ptsList[vfile.ntotalFrames - 1]);
+	printf("%d: %d ]\n", vfile.ntotalFrames - 1, vfile.index.pts[vfile.ntotalFrames - 1]);
 	printf("\nPTS List Sorted:\n");
 	printf("\t[");
 	for(int i = 0, j = 0; i < vfile.ntotalFrames - 1; ++i, ++j)
@@ -597,11 +1228,12 @@ void printVideoFileInfo(VideoFile vfile)
 			printf("\n\t");
 			j = 0;
 		}
-		printf("%d: %d, ", i, vfile.ptsListSorted[i]);
+		printf("%d: %d, ", i, vfile.index.displayPts[i]);
 	}
-	printf("%d: %d ]\n", vfile.ntotalFrames - 1, vfile.ptsListSorted[vfile.ntotalFrames - 1]);
+	printf("%d: %d ]\n", vfile.ntotalFrames - 1, vfile.index.displayPts[vfile.ntotalFrames - 1]);
 	#endif
-	printf("Number of frames: %d\n", vfile.nframes);
+	if(frameIndexReady(&vfile)) printf("Number of frames: %d\n", vfile.nframes);
+	else printf("Number of frames: ~%d (indexing)\n", vfile.estimatedFrames);
 	printf("> VIDEO FILE\n");
 	printf("\n");
 }